@@ -2,9 +2,9 @@
 #define YACAS_ANUMBER_H
 
 #include "lispstring.h"
+#include "smallvector.h"
 
 #include <cassert>
-#include <vector>
 #include <cctype>
 
 // These define the internal types for the arbitrary precision
@@ -24,19 +24,27 @@ typedef signed long PlatSignedDoubleWord;
 #define WordBase  (((PlatDoubleWord)1)<<WordBits)
 #define WordMask  (WordBase-1)
 
+/* Number of words stored inside the ANumber object itself; only
+ * numbers needing more than this go to the heap. Eight words cover
+ * integers up to 128 bits, and floats at the default precision.
+ */
+const std::size_t ANUMBER_INLINE_WORDS = 8;
+
 /* Class ANumber represents an arbitrary precision number. it is
  * basically an array of PlatWord objects, with the first element
  * being the least significant. iExp <= 0 for integers.
  */
-class ANumber : public std::vector<PlatWord>
+class ANumber : public SmallVector<PlatWord, ANUMBER_INLINE_WORDS>
 {
 public:
     ANumber(const char* aString,int aPrecision,int aBase=10);
     ANumber(int aPrecision);
-    //TODO the properties of this object are set in the member initialization list, but then immediately overwritten by the CopyFrom. We can make this slightly cleaner by only initializing once.
-    inline ANumber(const ANumber& aOther) : iExp(0),iNegative(false),iPrecision(0),iTensExp(0)
+    inline ANumber(const ANumber& aOther) :
+      SmallVector<PlatWord, ANUMBER_INLINE_WORDS>(aOther),
+      iExp(aOther.iExp),iNegative(aOther.iNegative),iPrecision(aOther.iPrecision),iTensExp(aOther.iTensExp)
     {
-      CopyFrom(aOther);
+      if (empty())
+        push_back(0);
     }
     void CopyFrom(const ANumber& aOther);
     bool ExactlyEqual(const ANumber& aOther);
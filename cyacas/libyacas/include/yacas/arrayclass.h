@@ -12,6 +12,7 @@ public:
     //required
     ArrayClass(std::size_t aSize,LispObject* aInitialItem);
     const char* TypeName() const override;
+    void Freeze(int aPrecision) override;
 
     //array-specific
     std::size_t Size() const;
@@ -34,6 +35,15 @@ const char* ArrayClass::TypeName() const
     return "\"Array\"";
 }
 
+inline
+void ArrayClass::Freeze(int aPrecision)
+{
+    GenericClass::Freeze(aPrecision);
+    for (LispPtr& p: iArray)
+        if (!!p)
+            p->Freeze(aPrecision);
+}
+
 inline
 std::size_t ArrayClass::Size() const
 {
@@ -36,6 +36,7 @@ class AssociationClass final: public GenericClass
 public:
     AssociationClass(const LispEnvironment& env);
     const char* TypeName() const override;
+    void Freeze(int aPrecision) override;
 
     std::size_t Size() const;
     bool Contains(LispObject* k) const;
@@ -84,6 +85,16 @@ const char* AssociationClass::TypeName() const
     return "\"Association\"";
 }
 
+inline
+void AssociationClass::Freeze(int aPrecision)
+{
+    GenericClass::Freeze(aPrecision);
+    for (auto& e: _map) {
+        e.first.value->Freeze(aPrecision);
+        e.second->Freeze(aPrecision);
+    }
+}
+
 inline
 std::size_t AssociationClass::Size() const
 {
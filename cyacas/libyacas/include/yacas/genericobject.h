@@ -1,14 +1,19 @@
 #ifndef YACAS_GENERICOBJECT_H
 #define YACAS_GENERICOBJECT_H
 
+#include "refcount.h"
+
 /// Abstract class which can be put inside a LispGenericClass.
 class GenericClass {
 public:
-    GenericClass() : iReferenceCount(0) {};
+    GenericClass() = default;
     virtual ~GenericClass() = default;
     virtual const char* TypeName() const = 0;
+    /// Make the object immortal and read-only, see LispObject::Freeze().
+    /// Classes referring to other objects freeze those too.
+    virtual void Freeze(int aPrecision) { iReferenceCount.Freeze(); }
 public:
-    unsigned iReferenceCount; //TODO: perhaps share the method of reference counting with how it is done in other places
+    ReferenceCount iReferenceCount;
 };
 
 #endif
@@ -0,0 +1,201 @@
+/** \file lisparena.h
+ *  Per-environment allocation arena for LispObject cells.
+ *
+ * class LispArena. Every LispObject is allocated through
+ * LispObject::operator new, which asks the arena that is current for
+ * the calling thread (see LispArenaScope) for a block. Small blocks
+ * are served from size-class free lists carved out of large chunks,
+ * so objects of one session never touch the pool of another one.
+ * Each block is preceded by a pointer to the region it came from,
+ * which allows it to be returned to the right arena no matter which
+ * arena is current at the time it is freed. If no arena is current,
+ * the block is obtained from PlatAlloc.
+ *
+ * Optionally, an arena can serve the allocations made during a
+ * top-level evaluation from a scratch region with a bump pointer.
+ * Freeing a block from the scratch region only decrements a counter;
+ * as soon as the region is empty (nothing escaped into globals) it is
+ * reclaimed in bulk by resetting the bump pointer.
+ *
+ * The arena also keeps track of the memory used by its environment:
+ * besides the LispObject cells, the digits of big numbers and the
+ * LispString objects are allocated from it. A limit can be set on
+ * the bytes allocated. Going over it is reported to a handler, which
+ * lets the environment stop the evaluation at its next safepoint;
+ * without a handler, or well beyond the limit, allocating throws
+ * LispErrMaxMemoryReached.
+ *
+ * With atomic reference counts (YACAS_ATOMIC_REFCOUNT) an object may
+ * be released by another thread than the one evaluating, so in that
+ * configuration the arena serializes access through a mutex.
+ */
+
+#ifndef YACAS_LISPARENA_H
+#define YACAS_LISPARENA_H
+
+#include "noncopyable.h"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#ifdef YACAS_ATOMIC_REFCOUNT
+#include <mutex>
+#endif
+
+class LispArena: NonCopyable {
+public:
+    /// Allocation statistics, all sizes are in bytes and include
+    /// the per-block bookkeeping overhead.
+    struct Statistics {
+        Statistics():
+            live_bytes(0), peak_bytes(0), allocations(0),
+            evaluation_allocations(0) {}
+
+        /// bytes currently allocated from the arena
+        std::size_t live_bytes;
+        /// maximum of live_bytes over the lifetime of the arena
+        std::size_t peak_bytes;
+        /// number of allocations over the lifetime of the arena
+        std::size_t allocations;
+        /// number of allocations during the current (or last)
+        /// top-level evaluation
+        std::size_t evaluation_allocations;
+    };
+
+    LispArena();
+
+    /// Give up ownership of the arena. The arena is destroyed as
+    /// soon as the last object allocated from it is freed.
+    void Release();
+
+    /// Deleter for std::unique_ptr, calls Release().
+    struct Releaser {
+        void operator()(LispArena* aArena) const { aArena->Release(); }
+    };
+
+    const Statistics& Stats() const;
+
+    /// Set the size of the scratch region used for allocations made
+    /// during a top-level evaluation. Zero (the default) disables
+    /// bulk reclaim.
+    void SetScratchSize(std::size_t aBytes);
+    std::size_t ScratchSize() const;
+
+    /// Set the maximum number of bytes live at any time, zero (the
+    /// default) means no limit. An allocation which exceeds the limit,
+    /// even once the objects waiting to be freed are (see
+    /// LispObject::Reclaim()), raises the limit signal (see TakeLimitSignal()) and calls the
+    /// limit handler, or throws LispErrMaxMemoryReached if there is
+    /// none. As the error has to be handled, the next allocations are
+    /// allowed to use another eighth of the limit, beyond which they
+    /// throw; the limit is enforced again as soon as the usage drops
+    /// below it.
+    void SetMemoryLimit(std::size_t aBytes);
+    std::size_t MemoryLimit() const;
+
+    /// Set the function called, on the allocating thread, when the
+    /// memory limit is exceeded. It must not allocate.
+    void SetLimitHandler(std::function<void()> aHandler);
+
+    /// Return whether the memory limit was exceeded since the last
+    /// call, or since the top-level evaluation started.
+    bool TakeLimitSignal();
+
+    /// Mark the start and the end of a top-level evaluation.
+    void BeginEvaluation();
+    void EndEvaluation();
+
+    /// Allocate a block of \a aSize bytes from the arena current for
+    /// this thread (or from PlatAlloc if there is none).
+    static void* New(std::size_t aSize);
+    /// Free a block allocated by New().
+    static void Delete(void* aObject, std::size_t aSize);
+
+    /// The arena current for this thread, or nullptr.
+    static LispArena* Current();
+
+private:
+    friend class LispArenaScope;
+
+    struct Region;
+
+    ~LispArena();
+
+#ifdef YACAS_ATOMIC_REFCOUNT
+    typedef std::unique_lock<std::mutex> Guard;
+    Guard Lock() { return Guard(iMutex); }
+    std::mutex iMutex;
+#else
+    struct Guard {
+        Guard() {}
+        ~Guard() {}
+    };
+    Guard Lock() { return Guard(); }
+#endif
+
+    void* Allocate(std::size_t aTotal);
+    /// Returns true if the arena has to be deleted.
+    bool Deallocate(Region* aRegion, void* aBlock, std::size_t aTotal);
+
+    void* AllocateFromHeap(std::size_t aTotal);
+    void RetireScratch();
+    void FreeRegion(Region* aRegion);
+
+    static thread_local LispArena* iCurrent;
+
+    Region* iHeap;
+    Region* iLarge;
+    Region* iScratch;
+    Region* iSpare;
+
+    std::vector<void*> iFreeLists;
+    std::vector<char*> iChunks;
+    char* iTop;
+    char* iEnd;
+
+    std::size_t iScratchSize;
+    std::size_t iMemoryLimit;
+    bool iMemoryLimitReached;
+    bool iLimitSignalled;
+    std::function<void()> iLimitHandler;
+    std::size_t iLiveBlocks;
+    int iEvaluationDepth;
+    bool iReleased;
+
+    Statistics iStats;
+};
+
+/// Make an arena current for this thread. The scope that makes an
+/// arena current first delimits a top-level evaluation.
+class LispArenaScope: NonCopyable {
+public:
+    explicit LispArenaScope(LispArena& aArena);
+    ~LispArenaScope();
+
+private:
+    LispArena& iArena;
+    LispArena* iPrevious;
+};
+
+inline LispArena* LispArena::Current()
+{
+    return iCurrent;
+}
+
+inline const LispArena::Statistics& LispArena::Stats() const
+{
+    return iStats;
+}
+
+inline std::size_t LispArena::ScratchSize() const
+{
+    return iScratchSize;
+}
+
+inline std::size_t LispArena::MemoryLimit() const
+{
+    return iMemoryLimit;
+}
+
+#endif
@@ -0,0 +1,84 @@
+/** \file lispargstack.h
+ *  The stack the core commands get their arguments on.
+ *
+ * class LispArgumentStack. YacasEvaluator::Evaluate() pushes the
+ * expression called and its arguments, the core command reads them
+ * with ARGUMENT(i) and leaves its result in RESULT, the slot of the
+ * expression. A core command keeps references to its slots while it
+ * evaluates further expressions, which push and pop above them, so
+ * the slots must not move when the stack grows: it is made of
+ * segments of a fixed size, which are allocated as the stack first
+ * gets that deep and then kept (a std::deque would free and allocate
+ * them again as the top crosses their boundaries).
+ *
+ * The interface is that of the standard containers, as far as it is
+ * needed. The slots above the top are always empty.
+ */
+
+#ifndef YACAS_LISPARGSTACK_H
+#define YACAS_LISPARGSTACK_H
+
+#include "lispobject.h"
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class LispArgumentStack {
+public:
+    LispArgumentStack(): iSize(0) { Grow(); }
+
+    std::size_t size() const { return iSize; }
+
+    LispPtr& operator[](std::size_t aIndex)
+    {
+        return iSegments[aIndex >> SEGMENT_BITS][aIndex & (SEGMENT_SIZE - 1)];
+    }
+
+    void push_back(const LispPtr& aValue)
+    {
+        LispPtr& slot = Push();
+        slot = aValue;
+    }
+
+    void push_back(LispPtr&& aValue)
+    {
+        LispPtr& slot = Push();
+        slot = std::move(aValue);
+    }
+
+    /// Pop down to \a aSize, or push empty slots up to it.
+    void resize(std::size_t aSize)
+    {
+        while (iSize > aSize)
+            (*this)[--iSize] = nullptr;
+
+        while ((iSegments.size() << SEGMENT_BITS) < aSize)
+            Grow();
+
+        iSize = aSize;
+    }
+
+private:
+    static const std::size_t SEGMENT_BITS = 8;
+    static const std::size_t SEGMENT_SIZE = std::size_t(1) << SEGMENT_BITS;
+
+    LispPtr& Push()
+    {
+        if ((iSize >> SEGMENT_BITS) == iSegments.size())
+            Grow();
+
+        return (*this)[iSize++];
+    }
+
+    void Grow()
+    {
+        iSegments.emplace_back(new LispPtr[SEGMENT_SIZE]);
+    }
+
+    std::vector<std::unique_ptr<LispPtr[]>> iSegments;
+    std::size_t iSize;
+};
+
+#endif
@@ -16,6 +16,8 @@
  * The string is held in the number (to avoid repeated conversions) and also cached in the string cache (this caching will eventually be abandoned).
  * When LispNumber is constructed from BigNumber, no string representation is available.
  * Conversion from string to BigNumber is done only if no BigNumber object is present.
+ * Whether the number is an integer is known from the start, so that telling
+ * the kind of a number, as pattern matching does, never converts it.
  */
 
 #ifndef YACAS_LISPATOM_H
@@ -26,6 +28,12 @@
 #include "numbers.h"  // RefPtr<BigNumber> needs definition of BigNumber
 #include "noncopyable.h"
 
+#include <cstdint>
+
+#ifndef YACAS_NO_ATOMIC_TYPES
+#include <atomic>
+#endif
+
 /// This should be used whenever constants 2, 10 mean binary and decimal.
 // maybe move somewhere else?
 #ifdef YACAS_NO_CONSTEXPR
@@ -45,6 +53,8 @@ public:
   ~LispAtom() override;
   const LispString* String() override;
   LispObject* Copy() const override { return new LispAtom(*this); }
+protected:
+  void FreezeData(int aPrecision) override;
 private:
   LispAtom(const LispString* aString);
   LispAtom& operator=(const LispAtom& aOther)
@@ -69,15 +79,63 @@ public:
   ~LispSubList() override;
   LispPtr* SubList() override { return &iSubList; }
   LispObject* Copy() const override { return new LispSubList(*this); }
+
+  /** Structural hash of the list. Lists which are equal according to
+   *  InternalEquals() have the same hash, so lists with different
+   *  hashes are different. Atoms contribute their (unique) string,
+   *  numbers only the fact that they are numbers, as they are
+   *  compared by value. The hash is computed when first asked for,
+   *  for all the sublists at once, and cached until Modified().
+   */
+  unsigned Hash();
+
+  /** Invalidate the cached hashes of all lists. Has to be called
+   *  whenever the elements of an existing list are relinked in place,
+   *  as is done by the Destructive* commands, because the lists
+   *  containing it can't be found. Frozen lists keep their hash.
+   */
+  static void Modified();
+
+protected:
+  void FreezeData(int aPrecision) override;
+
 private:
   // Constructor is private -- use New() instead
-  LispSubList(LispObject* aSubList) : iSubList(aSubList) {}  // iSubList's constructor is messed up (it's a LispPtr, duh)
+  LispSubList(LispObject* aSubList) : iHash(0), iSubList(aSubList), iHashEpoch(0) {}  // iSubList's constructor is messed up (it's a LispPtr, duh)
 public:
-  LispSubList(const LispSubList& other): LispObject(other), iSubList(other.iSubList) {}
+  LispSubList(const LispSubList& other);
 private:
+  bool HashValid(std::uint64_t aEpoch) const;
+
+  /// value of iEpoch when iHash was computed, PERMANENT for frozen
+  /// lists, zero if it hasn't been computed
+  static const std::uint64_t PERMANENT = ~static_cast<std::uint64_t>(0);
+
+#ifdef YACAS_NO_ATOMIC_TYPES
+  static std::uint64_t iEpoch;
+#else
+  static std::atomic<std::uint64_t> iEpoch;
+#endif
+
+  unsigned iHash;
   LispPtr iSubList;
+  std::uint64_t iHashEpoch;
 };
 
+inline LispSubList::LispSubList(const LispSubList& other):
+  LispObject(other),
+  iHash(other.iHash),
+  iSubList(other.iSubList),
+  // only frozen lists can't be modified
+  iHashEpoch(other.iHashEpoch == PERMANENT ? static_cast<std::uint64_t>(iEpoch) : other.iHashEpoch)
+{
+}
+
+inline bool LispSubList::HashValid(std::uint64_t aEpoch) const
+{
+  return iHashEpoch == aEpoch || iHashEpoch == PERMANENT;
+}
+
 
 //------------------------------------------------------------------------------
 // LispGenericClass
@@ -89,6 +147,8 @@ public:
   ~LispGenericClass() override;
   GenericClass* Generic() override;
   LispObject* Copy() const override { return new LispGenericClass(*this); }
+protected:
+  void FreezeData(int aPrecision) override;
 private:
   // Constructor is private -- use New() instead
   LispGenericClass(GenericClass* aClass);
@@ -110,22 +170,32 @@ class LispNumber: public LispObject
 public:
     /// constructors:
     /// construct from another LispNumber
-  LispNumber(BigNumber* aNumber) : iNumber(aNumber), iString(nullptr) {}
-  LispNumber(const LispNumber& other) : LispObject(other), iNumber(other.iNumber), iString(other.iString) {}
+  LispNumber(BigNumber* aNumber) : iNumber(aNumber), iString(nullptr), iSmall(0), iIsSmall(false), iIsInt(aNumber->IsInt()) {}
+  LispNumber(const LispNumber& other) : LispObject(other), iNumber(other.iNumber), iString(other.iString), iSmall(other.iSmall), iIsSmall(other.iIsSmall), iIsInt(other.iIsInt) {}
   /// construct from a decimal string representation (also create a number object) and use aBasePrecision decimal digits
-  LispNumber(LispString * aString, int aBasePrecision) : iNumber(nullptr), iString(aString) { Number(aBasePrecision); }
+  LispNumber(LispString * aString, int aBasePrecision);
+  /// construct a small integer; neither the string nor the BigNumber is created until requested
+  explicit LispNumber(long aValue) : iNumber(nullptr), iString(nullptr), iSmall(aValue), iIsSmall(true), iIsInt(true) {}
 
   LispObject* Copy() const override { return new LispNumber(*this); }
   /// return a string representation in decimal with maximum decimal precision allowed by the inherent accuracy of the number
   LispString * String() override;
   /// give access to the BigNumber object; if necessary, will create a BigNumber object out of the stored string, at given precision (in decimal?)
   BigNumber* Number(int aPrecision) override;
+  bool SmallInteger(long& aValue) override;
+  /// whether the number is an integer, as BigNumber::IsInt() tells, without converting it
+  bool IsInt() const { return iIsInt; }
+protected:
+  void FreezeData(int aPrecision) override;
 private:
   /// number object; nullptr if not yet converted from string
   RefPtr<BigNumber> iNumber;
   /// string representation in decimal; nullptr if not yet converted from BigNumber
   RefPtr<LispString> iString;
+  /// value of the number, valid only if iIsSmall is set
+  long iSmall;
+  bool iIsSmall;
+  bool iIsInt;
 };
 
-
 #endif
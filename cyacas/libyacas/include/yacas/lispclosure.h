@@ -0,0 +1,96 @@
+/** \file lispclosure.h
+ *  Rule predicates and bodies compiled to trees of closures.
+ *
+ * class LispClosure. Interpreting an expression means, for every node
+ * and at every evaluation, finding out again what the node is: a
+ * string, a variable to look up by name through all the frames of
+ * local variables, or a call for which the command has to be found.
+ * The predicates and the bodies of rules are evaluated over and over,
+ * so they are compiled once, when the rule is declared, to a tree of
+ * closures in which all of this is resolved:
+ *
+ * - strings and numbers become constants (numbers cannot be assigned
+ *   to),
+ * - references to the parameters of the rule, and to the variables of
+ *   its pattern, become slots in its frame of local variables,
+ * - calls keep their compiled arguments, and If and Prog are compiled
+ *   inline.
+ *
+ * A call to a fenced rule base in tail position (the body itself, the
+ * last statement of a Prog, a branch of an If in tail position) is not
+ * made from within the body: the arguments are evaluated and the call
+ * is handed back, see EvaluateTail(), to
+ * BranchingUserFunction::EvaluateRules(), which makes it once the
+ * local variables of the caller are gone. A linear recursion through
+ * tail calls thus runs in constant stack space, and does not count
+ * towards the maximum evaluation depth.
+ *
+ * What a call stands for is not fixed at compile time: it is looked up
+ * in the dispatch cache of the environment at every call, so that
+ * redefining a function, or a core command, needs no recompilation.
+ * Everything the compiled code has no special case for (macros, core
+ * commands taking a variable number of arguments, rule bases with a
+ * variable number of arguments, traced functions, pure functions...)
+ * is handed to the interpreter as it is.
+ *
+ * Evaluating a closure gives exactly what evaluating the expression it
+ * was compiled from gives with BasicEvaluator, so closures are only
+ * used when that is the evaluator of the environment (not while
+ * tracing or debugging), see Enabled().
+ */
+
+#ifndef YACAS_LISPCLOSURE_H
+#define YACAS_LISPCLOSURE_H
+
+#include "lispobject.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class BranchingUserFunction;
+class LispEnvironment;
+
+class LispClosure {
+public:
+    /// A call in tail position, which is left to the caller.
+    struct TailCall {
+        TailCall(): iFunction(nullptr) {}
+
+        const BranchingUserFunction* iFunction;
+        /// the call, as passed to LispUserFunction::Evaluate()
+        LispPtr iList;
+        /// the evaluated arguments, or copies of the ones on hold
+        std::vector<LispPtr> iArguments;
+    };
+
+    virtual ~LispClosure() = default;
+
+    /// Compile \a aExpression. \a aSlots are the names of the local
+    /// variables which are the last ones declared whenever the
+    /// closure is evaluated, in the order they are declared.
+    static std::shared_ptr<const LispClosure> Compile(LispPtr& aExpression, const std::vector<const LispString*>& aSlots);
+
+    /// Whether compiled closures may be used in \a aEnvironment: rule
+    /// compilation is enabled (see LispEnvironment::SetRuleCompilation())
+    /// and the evaluator is a BasicEvaluator.
+    static bool Enabled(LispEnvironment& aEnvironment);
+
+    /// Evaluate the closure, with the slots as the last local
+    /// variables of \a aEnvironment.
+    void Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult) const;
+
+    /// Evaluate the closure, where the slots end at local variable
+    /// \a aTop (see LispEnvironment::NrLocals()). The slots are only
+    /// accessed directly while no other local variable is declared,
+    /// otherwise the variables are looked up by name.
+    virtual void Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop) const = 0;
+
+    /// As Evaluate(), except that a call to a fenced rule base in tail
+    /// position is not made: it is stored in \a aCall, and true is
+    /// returned.
+    bool EvaluateTail(LispEnvironment& aEnvironment, LispPtr& aResult, TailCall& aCall) const;
+    virtual bool EvaluateTail(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall& aCall) const;
+};
+
+#endif
@@ -7,7 +7,9 @@
 #define YACAS_LISPENVIRONMENT_H
 
 #include "lispobject.h"
+#include "lispargstack.h"
 #include "lisphash.h"
+#include "lisphashcons.h"
 #include "lispevalhash.h"
 #include "lispuserfunc.h"
 #include "deffile.h"
@@ -20,11 +22,12 @@
 #include "errors.h"
 #include "noncopyable.h"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <string>
 #include <sstream>
 #include <vector>
-#include <deque>
 
 #include <unordered_set>
 
@@ -38,6 +41,7 @@ class LispOutput;
 class LispPrinter;
 class LispUserFunction;
 class LispMultiUserFunction;
+class BranchingUserFunction;
 class LispEvaluatorBase;
 class BasicEvaluator;
 class DefaultDebugger;
@@ -104,7 +108,17 @@ public:
   void PushLocalFrame(bool aFenced);
   void PopLocalFrame();
   void NewLocal(const LispString* aVariable, LispObject* aValue);
+  /// Drop the local variables declared after the first \a aSize,
+  /// which have to be in the innermost frame.
+  void PopLocals(std::size_t aSize);
   void CurrentLocals(LispPtr& aResult);
+
+  /// The number of local variables declared, in all the frames.
+  std::size_t NrLocals() const;
+
+  /// The value of the local variable \a aIndex, counting from the
+  /// first one declared, see NrLocals().
+  LispPtr& LocalValue(std::size_t aIndex);
   //@}
 
 public:
@@ -125,6 +139,17 @@ public:
   void RemoveCoreCommand(char* aString);
 
   inline  LispHashTable& HashTable();
+
+  /// Return the core command \a aName stands for, or nullptr.
+  const YacasEvaluator* CoreCommand(const LispString* aName);
+
+  /// Return the user function called by \a aArguments, a list with
+  /// the name of the function as its head, or by a call of \a aName
+  /// with \a aArity arguments, or nullptr if there is none.
+  ///
+  /// These lookups are made for every call, so they are cached per
+  /// symbol (see LispString::iId) until the core commands or the set of
+  /// user functions change.
   LispUserFunction* UserFunction(LispPtr& aArguments);
   LispUserFunction* UserFunction(const LispString* aName,int aArity);
 
@@ -152,6 +177,12 @@ public:
 
   void UnFenceRule(const LispString* aOperator,int aArity);
   void Retract(const LispString* aOperator,int aArity);
+
+  /// Return the rule base \a aOperator with \a aArity arguments, for
+  /// Memoize() and the like, loading its definition if needed. Throws
+  /// LispErrInvalidArg if there is none, or if it is a macro, as the
+  /// result of a macro depends on the variables of its caller.
+  BranchingUserFunction* MemoizableRule(const LispString* aOperator, int aArity);
   void HoldArgument(const LispString* aOperator, const LispString* aVariable);
 
   void Protect(const LispString*);
@@ -169,6 +200,52 @@ public:
   int BinaryPrecision(void) const;
   //@}
 
+public:
+  /// \name Sharing definitions between environments
+  //@{
+
+  /// Freeze the environment.
+  /// Everything reachable from the user functions, the global
+  /// variables and the symbol table (which holds the operator names)
+  /// is made immortal and read-only, see LispObject::Freeze(). Reference
+  /// counting is skipped for these objects from then on, and other
+  /// environments can Attach() to them.
+  void Freeze();
+
+  /// Take over the definitions of the frozen environment \a aFrozen.
+  /// Core commands, user functions, global variables, operators,
+  /// protected symbols and settings are copied, but the expressions are shared, so
+  /// nothing needs to be parsed again. Shared lists are copied before
+  /// they are modified. The hash table has to be a copy of the one of
+  /// \a aFrozen already, so that the atoms agree.
+  void Attach(const LispEnvironment& aFrozen);
+
+  /// Give the variables holding the frozen list \a aList, or a frozen
+  /// list containing it, a private copy, and set \a aList to its
+  /// counterpart in the copy, so that it can be modified in place.
+  /// Variables holding lists inside the copied one are moved to the
+  /// copy as well. Returns false if no variable holds \a aList.
+  bool Thaw(LispPtr& aList);
+
+  /// Enable or disable hash consing. While it is enabled, the
+  /// expressions read by Load() are interned (see LispHashCons), so
+  /// that identical subexpressions of the definitions are shared and
+  /// compare equal by pointer. Only the definitions are: the results
+  /// of evaluations are not interned, as interned lists are frozen
+  /// and never freed.
+  void SetHashConsing(bool aEnabled);
+
+  /// The table of canonical lists, or nullptr if hash consing is
+  /// disabled.
+  LispHashCons* HashCons();
+
+  /// Enable or disable evaluating rules through the closures they
+  /// are compiled to when they are declared, see LispClosure. With
+  /// rule compilation disabled all rules are interpreted.
+  void SetRuleCompilation(bool aEnabled);
+  bool RuleCompilation() const;
+  //@}
+
 public:
   void SetPrettyPrinter(const LispString* aPrettyPrinter);
   const LispString* PrettyPrinter();
@@ -190,6 +267,18 @@ public:
   LispOperators& Bodied();
   //@}
 
+public:
+  /// \name Properties of functions for pattern matching
+  /// The operands of a call to an associative or commutative function
+  /// are matched by MatchACList, in the patterns of the rules which
+  /// are defined while the function is declared so.
+  //@{
+  void SetAssociative(const LispString* aFunction, bool aAssociative = true);
+  void SetCommutative(const LispString* aFunction, bool aCommutative = true);
+  bool IsAssociative(const LispString* aFunction) const;
+  bool IsCommutative(const LispString* aFunction) const;
+  //@}
+
 public:
   /// \name Input and output
   //@{
@@ -209,13 +298,50 @@ public:
   //DeletingLispCleanup iCleanup;
   int iEvalDepth;
   int iMaxEvalDepth;
+  LispEvaluatorBase* iEvaluator;
+
+public:
+  /// \name Interrupting the evaluation
+  /// The evaluation is stopped cooperatively. The evaluators call
+  /// Safepoint() at every function call and every iteration of a
+  /// loop, which only counts down; every SAFEPOINT_INTERVAL calls it
+  /// looks whether the evaluation has to stop, and throws the
+  /// corresponding error if so. An interrupt or a deadline is thus
+  /// noticed after a bounded amount of work.
+  //@{
+
+  /// Stop the evaluation with LispErrUserInterrupt at the next
+  /// check. Can be called from another thread or a signal handler.
+  void Interrupt();
+  /// Drop an interrupt which hasn't been noticed yet.
+  void ClearInterrupt();
+
+  /// Stop the evaluation with LispErrTimeout once \a aDeadline has
+  /// passed, until ClearDeadline() is called. TrapError() doesn't trap
+  /// the error, so that the whole evaluation stops.
+  void SetDeadline(std::chrono::steady_clock::time_point aDeadline);
+  void ClearDeadline();
+
+  /// Check at the next safepoint instead of counting down, for
+  /// instance because the memory limit was exceeded (see
+  /// LispArena::SetLimitHandler()). Only for the evaluating thread.
+  void RequestSafepoint();
+
+  void Safepoint();
+  //@}
+
+private:
+  void CheckSafepoint();
+
+  int iSafepointCountdown;
 #ifdef YACAS_NO_ATOMIC_TYPES
   volatile bool
 #else
   std::atomic_bool
 #endif // YACAS_NO_ATOMIC_TYPES
-    stop_evaluation;
-  LispEvaluatorBase* iEvaluator;
+    iInterrupted;
+  bool iHasDeadline;
+  std::chrono::steady_clock::time_point iDeadline;
 
 public: // Error information when some error occurs.
   InputStatus iInputStatus;
@@ -246,15 +372,25 @@ public: // Error reporting
 private:
     LispPtr *FindLocal(const LispString * aVariable);
 
+    // Local variables are deep bound: _bindings holds, for every
+    // symbol (indexed by LispString::iId), the position in _local_vars
+    // of its innermost local variable, and every local variable holds
+    // the position of the one it shadows. A local variable is visible
+    // if it is not below _fence, the first one of the innermost fenced
+    // frame, so finding a local takes constant time however many
+    // frames there are.
+
+    static const std::size_t unbound = static_cast<std::size_t>(-1);
+
     struct LispLocalVariable {
-        LispLocalVariable(const LispString* var, LispObject* val):
-        var(var), val(val)
+        LispLocalVariable(const LispString* var, LispObject* val, std::size_t shadowed):
+        var(var), val(val), shadowed(shadowed)
         {
             ++var->iReferenceCount;
         }
 
         LispLocalVariable(const LispLocalVariable& v):
-        var(v.var), val(v.val)
+        var(v.var), val(v.val), shadowed(v.shadowed)
         {
             ++var->iReferenceCount;
         }
@@ -266,20 +402,25 @@ private:
 
         const LispString* var;
         LispPtr val;
+        std::size_t shadowed;
     };
 
     struct LocalVariableFrame {
-        LocalVariableFrame(std::size_t first, bool fenced):
-        first(first), fenced(fenced)
+        LocalVariableFrame(std::size_t first, bool fenced, std::size_t fence):
+        first(first), fenced(fenced), fence(fence)
         {
         }
 
         std::size_t first;
         bool fenced;
+        // _fence before the frame was pushed
+        std::size_t fence;
     };
 
     std::vector<LispLocalVariable> _local_vars;
     std::vector<LocalVariableFrame> _local_frames;
+    std::vector<std::size_t> _bindings;
+    std::size_t _fence;
 
 public:
   std::ostream* iInitialOutput;
@@ -304,8 +445,36 @@ private:
 
   LispIdentifiers& protected_symbols;
 
+  LispIdentifiers iAssociative;
+  LispIdentifiers iCommutative;
+
   LispInput* iCurrentInput;
 
+  LispHashCons* iHashCons;
+  bool iRuleCompilation;
+
+  /// What a symbol stands for as the head of a call. An entry is
+  /// valid as long as iGeneration is the current #iDispatchGeneration,
+  /// which InvalidateDispatch() increments whenever a core command or
+  /// a user function (of some arity) is added or removed.
+  struct DispatchEntry {
+      unsigned iGeneration;
+      int iArity;
+      const LispString* iName;
+      const YacasEvaluator* iCoreCommand;
+      LispMultiUserFunction* iMultiUserFunction;
+      /// user function for calls with iArity arguments
+      LispUserFunction* iUserFunction;
+  };
+
+  DispatchEntry& Dispatch(const LispString* aName);
+  void FillDispatch(DispatchEntry& aEntry, const LispString* aName);
+  void InvalidateDispatch();
+
+  /// dispatch cache, indexed by LispString::iId
+  std::vector<DispatchEntry> iDispatch;
+  unsigned iDispatchGeneration;
+
   const LispString* iPrettyReader;
   const LispString* iPrettyPrinter;
 public:
@@ -313,7 +482,21 @@ public:
   XmlTokenizer  iXmlTokenizer;
   LispTokenizer* iCurrentTokenizer;
 
-  std::deque<LispPtr> iStack;
+  LispArgumentStack iStack;
+
+  /// Scratch stack the variables of a pattern are bound on while it
+  /// is matched, see YacasPatternPredicateBase::Matches().
+  std::vector<LispPtr> iPatternBindings;
+
+  /// The bindings made while matching, most recent last, so that
+  /// MatchACList can undo them when it tries another way.
+  std::vector<LispPtr*> iPatternTrail;
+
+  /// Scratch stacks for looking up the rules which may match, see
+  /// BranchingUserFunction::MatchRule(). MatchACList keeps the
+  /// operands it matches on iPatternTerms as well.
+  std::vector<std::size_t> iRuleCandidates;
+  std::vector<LispObject*> iPatternTerms;
 };
 
 inline int LispEnvironment::Precision(void) const
@@ -338,11 +521,79 @@ inline const LispUserFunctions& LispEnvironment::UserFunctions() const
     return iUserFunctions;
 }
 
+inline LispEnvironment::DispatchEntry& LispEnvironment::Dispatch(const LispString* aName)
+{
+    const unsigned id = aName->iId;
+
+    if (id >= iDispatch.size())
+        iDispatch.resize(std::max(id + 1, iHashTable.IdLimit()));
+
+    DispatchEntry& entry = iDispatch[id];
+
+    if (entry.iGeneration != iDispatchGeneration || entry.iName != aName)
+        FillDispatch(entry, aName);
+
+    return entry;
+}
+
+inline const YacasEvaluator* LispEnvironment::CoreCommand(const LispString* aName)
+{
+    return Dispatch(aName).iCoreCommand;
+}
+
+inline LispUserFunction* LispEnvironment::UserFunction(const LispString* aName, int aArity)
+{
+    DispatchEntry& entry = Dispatch(aName);
+
+    if (entry.iArity != aArity && entry.iMultiUserFunction) {
+        entry.iUserFunction = entry.iMultiUserFunction->UserFunc(aArity);
+        entry.iArity = aArity;
+    }
+
+    return entry.iUserFunction;
+}
+
+inline LispHashCons* LispEnvironment::HashCons()
+{
+    return iHashCons;
+}
+
+inline void LispEnvironment::SetRuleCompilation(bool aEnabled)
+{
+    iRuleCompilation = aEnabled;
+}
+
+inline bool LispEnvironment::RuleCompilation() const
+{
+    return iRuleCompilation;
+}
+
+inline std::size_t LispEnvironment::NrLocals() const
+{
+    return _local_vars.size();
+}
+
+inline LispPtr& LispEnvironment::LocalValue(std::size_t aIndex)
+{
+    return _local_vars[aIndex].val;
+}
+
 inline LispHashTable& LispEnvironment::HashTable()
 {
     return iHashTable;
 }
 
+inline void LispEnvironment::RequestSafepoint()
+{
+    iSafepointCountdown = 0;
+}
+
+inline void LispEnvironment::Safepoint()
+{
+    if (--iSafepointCountdown <= 0)
+        CheckSafepoint();
+}
+
 
 
 // Local lisp stack, unwindable by the exception handler
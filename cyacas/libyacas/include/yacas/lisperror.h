@@ -148,6 +148,12 @@ public:
         LispError("Max evaluation stack depth reached.\nPlease use MaxEvalDepth to increase the stack size as needed.") {}
 };
 
+class LispErrMaxMemoryReached: public LispError {
+public:
+    LispErrMaxMemoryReached():
+        LispError("Memory limit reached.") {}
+};
+
 class LispErrDefFileAlreadyChosen: public LispError {
 public:
     LispErrDefFileAlreadyChosen():
@@ -196,6 +202,12 @@ public:
         LispError("User interrupted calculation") {}
 };
 
+class LispErrTimeout: public LispError {
+public:
+    LispErrTimeout():
+        LispError("Evaluation timed out") {}
+};
+
 class LispErrNonBooleanPredicateInPattern: public LispError {
 public:
     LispErrNonBooleanPredicateInPattern():
@@ -208,6 +220,12 @@ public:
         LispError(std::string("Attempt to override protected symbol: ") + s) {}
 };
 
+class LispErrFrozenObject: public LispError {
+public:
+    LispErrFrozenObject():
+        LispError("Attempt to modify a frozen object") {}
+};
+
 class LispErrGeneric: public LispError {
 public:
     LispErrGeneric(const std::string& what):
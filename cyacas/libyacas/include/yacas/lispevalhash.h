@@ -32,6 +32,10 @@ public:
   void Evaluate(LispPtr& aResult,
                 LispEnvironment& aEnvironment,
                 LispPtr& aArguments) const override;
+
+  YacasEvalCaller Caller() const { return iCaller; }
+  int NrArgs() const { return iNrArgs; }
+  int Flags() const { return iFlags; }
 private:
   YacasEvalCaller iCaller;
   int iNrArgs;
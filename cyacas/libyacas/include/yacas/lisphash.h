@@ -1,6 +1,6 @@
 /** \file lisphash.h
  *  hashing of strings. Each string will exist only once in the
- * hash table, and have an unique id.
+ * hash table, and have an unique id (LispString::iId).
  */
 
 
@@ -10,6 +10,7 @@
 #include "lispstring.h"
 
 #include <unordered_map>
+#include <vector>
 
 /**
  * This is the symbol table, implemented as a hash table for fast
@@ -20,13 +21,34 @@
  */
 class LispHashTable {
 public:
+    LispHashTable();
+
     // If string not yet in table, insert. Afterwards return the string.
     const LispString* LookUp(const std::string&);
     void GarbageCollect();
+    // Make all the strings currently in the table immortal, see
+    // LispObject::Freeze().
+    void Freeze();
+
+    // One more than the largest id given to a string (see
+    // LispString::iId). The ids of collected strings are reused.
+    unsigned IdLimit() const;
 
 private:
     std::unordered_map<std::string, LispStringSmartPtr> _rep;
+    std::vector<unsigned> _free_ids;
+    unsigned _id_limit;
 };
 
+inline LispHashTable::LispHashTable():
+    _id_limit(1)
+{
+}
+
+inline unsigned LispHashTable::IdLimit() const
+{
+    return _id_limit;
+}
+
 
 #endif
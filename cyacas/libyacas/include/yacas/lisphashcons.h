@@ -0,0 +1,76 @@
+/** \file lisphashcons.h
+ *  Maximal sharing of loaded definitions.
+ *
+ * class LispHashCons. A table of canonical lists. Intern() walks an
+ * expression bottom-up and makes every sublist refer to the canonical
+ * list with the same structure, so that structurally identical
+ * subexpressions are stored once and compare equal by pointer.
+ *
+ * An element of a list can only be part of one Nixed() chain, so what
+ * is shared are the chains held by the LispSubList objects, not the
+ * LispSubList objects themselves. Canonical chains are frozen (see
+ * LispObject::Freeze()): they are never modified, destructive
+ * operations work on a copy, and they are never deleted.
+ *
+ * Lists headed by \c List are data rather than code and are not
+ * shared, scripts modify them in place (e.g. with DestructiveDelete),
+ * and neither is anything containing them.
+ *
+ * Lists are interned once they are complete, as the parsers and many
+ * core functions still modify a list after wrapping it up with
+ * LispSubList::New(). The environment interns the expressions read by
+ * Load() while hash consing is enabled, see
+ * LispEnvironment::SetHashConsing(). The results of evaluations are
+ * not interned: the table only grows, so interning every new value
+ * would keep all of them alive.
+ */
+
+#ifndef YACAS_LISPHASHCONS_H
+#define YACAS_LISPHASHCONS_H
+
+#include "lispobject.h"
+
+#include <cstddef>
+#include <unordered_map>
+
+class LispHashCons {
+public:
+    /// \a aList is the \c List atom of the symbol table.
+    explicit LispHashCons(const LispString* aList);
+
+    /// Make the sublists of \a aExpression, at any depth, refer to
+    /// canonical chains. Chains not seen before become canonical and
+    /// are frozen, numbers at \a aPrecision. Lists holding generic
+    /// objects are left alone.
+    void Intern(LispPtr& aExpression, int aPrecision);
+
+    /// Number of canonical chains.
+    std::size_t Size() const;
+
+private:
+    /// Intern the sublist of \a aObject, if it has one, and compute
+    /// its structural hash. Returns false if \a aObject can't be
+    /// shared.
+    bool Intern(LispObject* aObject, int aPrecision, std::size_t& aHash);
+
+    /// Whether the elements \a a1 and \a a2 (of interned chains) are
+    /// interchangeable.
+    static bool Identical(LispObject* a1, LispObject* a2);
+
+    const LispString* iList;
+
+    /// canonical chains, by structural hash
+    std::unordered_multimap<std::size_t, LispObject*> iChains;
+};
+
+inline LispHashCons::LispHashCons(const LispString* aList):
+    iList(aList)
+{
+}
+
+inline std::size_t LispHashCons::Size() const
+{
+    return iChains.size();
+}
+
+#endif
@@ -0,0 +1,91 @@
+/** \file lispmemo.h
+ *  The results remembered for a rule base, see Memoize().
+ *
+ * class LispMemoTable. A rule base whose result only depends on its
+ * arguments can remember the results of its calls, so that calling it
+ * again with the same arguments returns the result right away. The
+ * table is keyed on the evaluated arguments and the precision, which
+ * the result of a numerical function depends on. Arguments are
+ * compared strictly: atoms by name, numbers by their decimal digits,
+ * lists element by element, and other objects by identity, so that 2
+ * and 2.0 are different keys.
+ *
+ * The table holds at most Limit() results; when it is full, the one
+ * used least recently is dropped.
+ *
+ * Like the value of a variable, a remembered result is shared with
+ * whoever gets it, and a destructive operation on it changes what is
+ * remembered.
+ */
+
+#ifndef YACAS_LISPMEMO_H
+#define YACAS_LISPMEMO_H
+
+#include "lispobject.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+class LispMemoTable {
+public:
+    /// The arguments of a call, with what is needed to look them up.
+    struct Key {
+        std::vector<LispPtr> iArguments;
+        int iPrecision;
+        unsigned iHash;
+        /// value of LispMemoTable::iGeneration when the key was made
+        std::uint64_t iGeneration;
+    };
+
+    explicit LispMemoTable(std::size_t aLimit);
+
+    /// The key for the \a aArity arguments \a aArguments, evaluated
+    /// at \a aPrecision.
+    Key MakeKey(const LispPtr* aArguments, std::size_t aArity, int aPrecision) const;
+
+    /// Return true, with the result in \a aResult, if the result for
+    /// \a aKey is remembered. Counts a hit or a miss.
+    bool Find(const Key& aKey, LispPtr& aResult);
+
+    /// Remember \a aResult for \a aKey, unless the table was cleared
+    /// since the key was made: the result may come from rules which
+    /// are gone.
+    void Insert(Key&& aKey, const LispPtr& aResult);
+
+    /// Forget all the results, for instance because the rules changed.
+    void Clear();
+
+    std::size_t Limit() const { return iLimit; }
+
+    /// Change the maximum number of results, forgetting the ones used
+    /// least recently if there are too many.
+    void SetLimit(std::size_t aLimit);
+
+    std::size_t Size() const { return iEntries.size(); }
+    std::uint64_t Hits() const { return iHits; }
+    std::uint64_t Misses() const { return iMisses; }
+
+private:
+    struct Entry {
+        Key iKey;
+        LispPtr iResult;
+    };
+
+    typedef std::list<Entry> Entries;
+
+    Entries::iterator Lookup(const Key& aKey);
+    void Evict();
+
+    /// most recently used first
+    Entries iEntries;
+    std::unordered_multimap<unsigned, Entries::iterator> iIndex;
+    std::size_t iLimit;
+    std::uint64_t iGeneration;
+    std::uint64_t iHits;
+    std::uint64_t iMisses;
+};
+
+#endif
@@ -18,6 +18,7 @@
 #include "genericobject.h"
 #include "noncopyable.h"
 #include "stubs.h"
+#include "lisparena.h"
 
 class LispObject;
 class BigNumber;
@@ -44,7 +45,7 @@ public:
   inline LispPtr& Nixed();
 
 public: //Derivables
-  virtual ~LispObject() = default;
+  virtual ~LispObject();
 
   /** Return string representation, or nullptr if the object doesn't have one.
    *  the string representation is only relevant if the object is a
@@ -61,8 +62,39 @@ public: //Derivables
    */
   virtual BigNumber* Number(int aPrecision) { return nullptr; }
 
+  /** If this is an integer small enough to fit in a long, store it in
+   *  aValue and return true. Unlike Number(), this never allocates.
+   */
+  virtual bool SmallInteger(long& aValue) { return false; }
+
   virtual LispObject* Copy() const = 0;
 
+  /** Make this object, and everything reachable from it, immortal.
+   *  The reference counts are frozen, so the objects are never deleted
+   *  and can be shared read-only between environments (and threads).
+   *  Cached representations are filled in first, numbers at
+   *  \a aPrecision, as frozen objects are never modified.
+   */
+  void Freeze(int aPrecision);
+
+  /** Objects are not destroyed recursively. When the last reference to
+   *  an object held by an object being destroyed goes away, it is put
+   *  on a (per thread) work list, which the outermost destructor works
+   *  off. Freeing a tree of any depth thus takes bounded stack space.
+   *
+   *  With a budget set, the outermost destructor frees at most
+   *  \a aObjects objects and leaves the rest for later destructions or
+   *  for Reclaim(), so that a large expression can be freed when the
+   *  application is idle rather than when a result is returned.
+   *  Zero (the default) means no limit.
+   */
+  static void SetReclaimBudget(std::size_t aObjects);
+
+  /** Free up to \a aObjects of the objects waiting on the work list of
+   *  this thread. Returns the number of objects still waiting.
+   */
+  static std::size_t Reclaim(std::size_t aObjects = static_cast<std::size_t>(-1));
+
 public:
   int Equal(LispObject& aOther);
   inline int operator==(LispObject& aOther);
@@ -82,15 +114,24 @@ protected:
     return *this;
   }
 
+  /// Freeze the data held by this object; iNext and the sublist are
+  /// taken care of by Freeze().
+  virtual void FreezeData(int aPrecision) {}
+
+  /// Drop the reference held by \a aPtr; if it was the last one the
+  /// object is put on the work list instead of being deleted right
+  /// away, see SetReclaimBudget().
+  static void Dispose(LispPtr& aPtr);
+
 
 private:
   LispPtr   iNext;
 public:
-  unsigned iReferenceCount;
+  ReferenceCount iReferenceCount;
   
-  static inline void* operator new(size_t size) { return PlatAlloc(size); }
+  static inline void* operator new(size_t size) { return LispArena::New(size); }
   static inline void* operator new[](size_t size) { return PlatAlloc(size); }
-  static inline void operator delete(void* object) { PlatFree(object); }
+  static inline void operator delete(void* object, size_t size) { LispArena::Delete(object, size); }
   static inline void operator delete[](void* object) { PlatFree(object); }
   // Placement form of new and delete.
   static inline void* operator new(size_t, void* where) { return where; }
@@ -188,5 +229,16 @@ inline int LispObject::operator!=(LispObject& aOther)
     return !Equal(aOther);
 }
 
+/** Evaluating a variable returns its value itself rather than a copy,
+ *  so a result may be shared. Before an object is linked into a list,
+ *  which sets its Nixed(), it has to be made private: Detach() replaces
+ *  \a aObject by a copy unless this is the only reference to it.
+ */
+inline void Detach(LispPtr& aObject)
+{
+    if (aObject->iReferenceCount != 1)
+        aObject = aObject->Copy();
+}
+
 
 #endif
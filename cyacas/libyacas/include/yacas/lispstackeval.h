@@ -0,0 +1,154 @@
+/** \file lispstackeval.h
+ *  An evaluator which keeps what is left to do on a stack of its own.
+ *
+ * class StackEvaluator. With BasicEvaluator, Eval(), the rule bases
+ * and the core commands call each other recursively, so an evaluation
+ * can only go as deep as the native stack allows, which is what
+ * LispEnvironment::iMaxEvalDepth guards against. StackEvaluator
+ * evaluates
+ *
+ * - the arguments of core functions and of rule bases,
+ * - the bodies of the rules,
+ * - If, Prog and List,
+ *
+ * by pushing frames on a vector instead, so that nesting these costs
+ * heap memory rather than native stack, and the maximum evaluation
+ * depth can be raised as far as memory allows. Everything else
+ * (macros, the predicates of rules, rule bases which remember their
+ * results, core commands which evaluate their arguments themselves,
+ * such as While...) is evaluated as
+ * BasicEvaluator does, calling Eval() recursively; such a nested
+ * evaluation runs on top of the same stack of frames.
+ *
+ * A call to a fenced rule base which is the last thing the frames
+ * below it do (a body, a branch of If, the last statement of Prog)
+ * replaces these frames once its arguments are evaluated, so that a
+ * recursion through tail calls runs in constant space.
+ *
+ * As an evaluation is entirely described by its frames, the outermost
+ * one can be paused and resumed, see Start() and Resume(), and
+ * ShowFrames() shows exactly what is being evaluated, also when an
+ * error occurs.
+ */
+
+#ifndef YACAS_LISPSTACKEVAL_H
+#define YACAS_LISPSTACKEVAL_H
+
+#include "lispeval.h"
+
+#include <cstddef>
+#include <vector>
+
+class BranchingUserFunction;
+class YacasEvaluator;
+
+class StackEvaluator final: public LispEvaluatorBase {
+public:
+    StackEvaluator();
+
+    void Eval(LispEnvironment& aEnvironment, LispPtr& aResult, LispPtr& aExpression) override;
+
+    /// Print the innermost \a aCount frames, in the format of
+    /// TracedStackEvaluator::ShowStack(), which this evaluator gets
+    /// for free.
+    void ShowFrames(LispEnvironment& aEnvironment, std::ostream& aOutput, std::size_t aCount) const;
+
+    /// Print the innermost SHOWN_FRAMES frames. Errors show them, as
+    /// TracedStackEvaluator does under TraceStack().
+    void ShowStack(LispEnvironment& aEnvironment, std::ostream& aOutput) override;
+
+    /// The number of frames ShowStack() prints, so that a runaway
+    /// recursion doesn't flood the output.
+    static const std::size_t SHOWN_FRAMES = 20;
+
+    /// Start evaluating \a aExpression, outside of any other
+    /// evaluation. The evaluation is carried out by Resume().
+    void Start(LispEnvironment& aEnvironment, LispPtr& aExpression);
+
+    /// Carry on with the evaluation started by Start() for at most
+    /// \a aSteps steps. Returns true, with the result in \a aResult,
+    /// once the evaluation is finished. Until then, the local
+    /// variables of the evaluation are declared in \a aEnvironment,
+    /// which must not be used for anything else in between.
+    bool Resume(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aSteps);
+
+    /// Give up the evaluation started by Start().
+    void Abandon(LispEnvironment& aEnvironment);
+
+private:
+    struct Frame {
+        enum Kind {
+            CoreArguments, ///< the arguments of a core function
+            UserArguments, ///< the arguments of a rule base
+            Body,          ///< the body of the rule which matched
+            If,            ///< the predicate, then a branch, of If
+            Prog,          ///< the statements of Prog
+            List           ///< the elements of List, or the arguments of
+                           ///< an undefined function
+        };
+
+        Frame(Kind aKind, LispPtr& aExpression);
+
+        Kind iKind;
+        /// the expression evaluated, a list
+        LispPtr iExpression;
+        /// the next argument or statement to evaluate
+        LispPtr* iNext;
+        /// whether the value of the previous one is on its way, in iValue
+        bool iPending;
+        /// whether the frame declared a frame of local variables
+        bool iLocals;
+        /// number of arguments or statements evaluated (for If, the
+        /// branch is number 1)
+        std::size_t iIndex;
+
+        /// for CoreArguments
+        const YacasEvaluator* iCore;
+        std::size_t iStackTop;
+        /// for UserArguments and Body
+        const BranchingUserFunction* iFunction;
+        std::vector<LispPtr> iArguments;
+        int iPrecedence;
+        /// for List, the result and its end
+        LispPtr iList;
+        LispPtr* iTail;
+    };
+
+    /// Evaluate \a aExpression if it can be done right away, leaving
+    /// the result in iValue and returning true. Otherwise, push the
+    /// frame which evaluates it and return false.
+    bool Push(LispEnvironment& aEnvironment, LispPtr& aExpression);
+
+    /// Go on with the frame on top, until it has to wait for another
+    /// frame or it is done.
+    void Step(LispEnvironment& aEnvironment);
+
+    /// Run the frames above \a aBase, for at most \a aSteps steps.
+    /// Returns true if they are all done.
+    bool Run(LispEnvironment& aEnvironment, std::size_t aBase, std::size_t aSteps);
+
+    /// Remove the frame on top, which is done.
+    void Pop(LispEnvironment& aEnvironment);
+
+    /// Remove the frames above \a aBase, after an error.
+    void Unwind(LispEnvironment& aEnvironment, std::size_t aBase);
+
+    /// The frame on top calls a rule base, whose arguments are
+    /// evaluated: remove the frames below it which only wait for its
+    /// result.
+    void TailCall(LispEnvironment& aEnvironment);
+
+    bool StepCoreArguments(LispEnvironment& aEnvironment, std::size_t aIndex);
+    bool StepUserArguments(LispEnvironment& aEnvironment, std::size_t aIndex);
+    bool StepIf(LispEnvironment& aEnvironment, std::size_t aIndex);
+    bool StepProg(LispEnvironment& aEnvironment, std::size_t aIndex);
+    bool StepList(LispEnvironment& aEnvironment, std::size_t aIndex);
+
+    std::vector<Frame> iFrames;
+    /// the frames of the current (possibly nested) run start here
+    std::size_t iBase;
+    /// the value of the frame which was done last
+    LispPtr iValue;
+};
+
+#endif
@@ -6,6 +6,7 @@
 #ifndef YACAS_LISPSTRING_H
 #define YACAS_LISPSTRING_H
 
+#include "lisparena.h"
 #include "refcount.h"
 
 #include <string>
@@ -20,16 +21,40 @@ class LispString : public std::string
 {
 public:
     explicit LispString(const std::string& = "");
+    // a copy is not in the symbol table
+    LispString(const LispString&);
+    LispString& operator=(const LispString&);
 
 public:
-    mutable unsigned iReferenceCount;
+    mutable ReferenceCount iReferenceCount;
+
+    /// Id of a string in the symbol table (see LispHashTable), zero
+    /// for other strings. Ids are small, so they can index per-symbol
+    /// tables such as the dispatch cache of LispEnvironment.
+    unsigned iId;
+
+    // allocated from the current arena, like LispObject
+    static void* operator new(std::size_t aSize) { return LispArena::New(aSize); }
+    static void operator delete(void* aObject, std::size_t aSize) { LispArena::Delete(aObject, aSize); }
 };
 
 
 inline LispString::LispString(const std::string& s):
     std::string(s),
-    iReferenceCount(0)
+    iId(0)
+{
+}
+
+inline LispString::LispString(const LispString& s):
+    std::string(s),
+    iId(0)
+{
+}
+
+inline LispString& LispString::operator=(const LispString& s)
 {
+    std::string::operator=(s);
+    return *this;
 }
 
 /** \class LispStringSmartPtr for managing strings outside
@@ -86,8 +111,7 @@ LispStringSmartPtr& LispStringSmartPtr::operator=(const LispString* aString)
     ++aString->iReferenceCount;
   if (iString)
   {
-    --iString->iReferenceCount;
-    if (iString->iReferenceCount == 0) delete iString;
+    if (--iString->iReferenceCount == 0) delete iString;
   }
   iString = aString;
   return *this;
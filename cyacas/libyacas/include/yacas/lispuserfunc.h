@@ -26,6 +26,9 @@ public:
                              LispPtr& aBody) = 0;
     virtual const LispPtr& ArgList() const = 0;
 
+    /// Freeze the argument list and the rules, see LispObject::Freeze().
+    virtual void Freeze(int aPrecision) = 0;
+
 public: //unfencing
     inline void UnFence() {iFenced = false;};
     inline bool Fenced() const {return iFenced;};
@@ -48,6 +51,14 @@ class LispArityUserFunction : public LispUserFunction
 public:
     virtual int Arity() const = 0;
     virtual int IsArity(int aArity) const = 0;
+
+    /// Return a copy with its own set of rules, sharing the
+    /// expressions (argument list, predicates and bodies) with this one.
+    virtual LispArityUserFunction* Clone() const = 0;
+
+    /// Forget the results remembered of earlier calls, if any, as
+    /// they may no longer hold.
+    virtual void Forget() {}
 };
 
 
@@ -66,15 +77,11 @@ public:
   LispMultiUserFunction() : iFunctions(),iFileToOpen(nullptr) {};
 
   /** When adding a multi-user function to the association hash table, the copy constructor is used.
-   *  We should at least make sure that iFunctions is empty, so there is no copying needed (for efficiency).
-   *  Casually having a copy-constructor on CDeletingArrayGrower should be avoided, to make sure it is
-   *  not used accidentally.
+   *  The functions are cloned (see LispArityUserFunction::Clone()), which is only needed when
+   *  attaching an environment to a frozen one. iFileToOpen still refers to the LispDefFile of
+   *  the original.
    */
-  inline LispMultiUserFunction(const LispMultiUserFunction& aOther) : iFunctions(), iFileToOpen(nullptr)
-  {
-    assert(aOther.iFileToOpen == 0);
-    assert(aOther.iFunctions.size() == 0);
-  }
+  LispMultiUserFunction(const LispMultiUserFunction& aOther);
   inline LispMultiUserFunction& operator=(const LispMultiUserFunction& aOther)
   {
     // copy constructor not written yet, hence the assert
@@ -101,6 +108,14 @@ public:
   /// Delete tuser function with given arity.
   virtual void DeleteBase(int aArity);
 
+  /// Freeze all the functions, see LispObject::Freeze().
+  void Freeze(int aPrecision);
+
+  /// Forget the results remembered by all the functions, see
+  /// LispArityUserFunction::Forget(). Called whenever the rules for
+  /// this name change.
+  void Forget();
+
 private:
   /// Set of LispArityUserFunction's provided by this LispMultiUserFunction.
   std::vector<LispArityUserFunction*> iFunctions;
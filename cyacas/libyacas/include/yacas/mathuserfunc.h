@@ -2,9 +2,14 @@
 #define YACAS_MATHUSERFUNC_H
 
 #include "lispuserfunc.h"
+#include "lispclosure.h"
+#include "lispmemo.h"
 #include "patternclass.h"
+#include "patterntree.h"
 #include "noncopyable.h"
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 /// A mathematical function defined by several rules.
@@ -32,6 +37,30 @@ public:
     virtual bool Matches(LispEnvironment& aEnvironment, LispPtr* aArguments) = 0;
     virtual int Precedence() const = 0;
     virtual LispPtr& Body() = 0;
+    /// Freeze the predicate and the body, see LispObject::Freeze().
+    virtual void Freeze(int aPrecision) = 0;
+    /// Return a copy sharing the predicate and the body.
+    virtual BranchRuleBase* Clone() const = 0;
+    /// Compile the predicate and the body to closures, see LispClosure.
+    /// \param aParameters names of the parameters of the function
+    virtual void Compile(const std::vector<const LispString*>& aParameters) = 0;
+    /// The compiled body, or nullptr if the rule is not compiled.
+    const LispClosure* CompiledBody() const { return iCompiledBody.get(); }
+    /// Return false if the rule can't match arguments of kinds
+    /// \a aKinds and symbols \a aSymbols (see ArgumentFilter), of which
+    /// the first \a aCount are known.
+    bool MayMatch(const unsigned* aKinds, const LispString* const* aSymbols, std::size_t aCount) const;
+    /// Return true if MayMatch() may return false.
+    bool Filtered() const { return !iFilters.empty(); }
+    /// The keys of the arguments the rule may match, in prefix order,
+    /// see PatternTree. By default, \a aArity times anything.
+    virtual std::vector<PatternKey> Keys(std::size_t aArity) const;
+    /// Sorts as the place of the rule in #iRules, see NumberRule().
+    std::uint64_t iOrder = 0;
+  protected:
+    std::shared_ptr<const LispClosure> iCompiledBody;
+    /// Filters of the arguments, or nothing if the rule may match any.
+    std::vector<ArgumentFilter> iFilters;
   };
 
   /// A rule with a predicate.
@@ -44,7 +73,8 @@ public:
     }
 
     /// Return true if the rule matches.
-    /// #iPredicate is evaluated in \a Environment. If the result
+    /// #iPredicate is evaluated in \a Environment, through
+    /// #iCompiledPredicate if LispClosure::Enabled(). If the result
     /// IsTrue(), this function returns true.
     bool Matches(LispEnvironment& aEnvironment, LispPtr* aArguments);
 
@@ -53,12 +83,17 @@ public:
 
     /// Access #iBody.
     LispPtr& Body();
+
+    void Freeze(int aPrecision);
+    BranchRuleBase* Clone() const;
+    void Compile(const std::vector<const LispString*>& aParameters);
   protected:
     BranchRule() : iPrecedence(0),iBody(),iPredicate() {};
   protected:
     int iPrecedence;
     LispPtr iBody;
     LispPtr iPredicate;
+    std::shared_ptr<const LispClosure> iCompiledPredicate;
   };
 
   /// A rule that always matches.
@@ -72,6 +107,8 @@ public:
     }
     /// Return #true, always.
     bool Matches(LispEnvironment& aEnvironment, LispPtr* aArguments);
+
+    BranchRuleBase* Clone() const;
   };
 
   /// A rule which matches if the corresponding PatternClass matches.
@@ -89,6 +126,10 @@ public:
       if (!pat)
         throw LispErrInvalidArg();
       iPatternClass = pat;
+
+      for (const ArgumentFilter& filter: pat->Filters())
+        if (!filter.AcceptsAll())
+          iFilters = pat->Filters();
     }
 
     /// Return true if the corresponding pattern matches.
@@ -100,6 +141,16 @@ public:
     /// Access #iBody
     LispPtr& Body();
 
+    void Freeze(int aPrecision);
+    BranchRuleBase* Clone() const;
+
+    /// The keys of the pattern, if it has \a aArity parameters.
+    std::vector<PatternKey> Keys(std::size_t aArity) const override;
+
+    /// Compile the body, in which the variables of the pattern are
+    /// local variables declared after the parameters.
+    void Compile(const std::vector<const LispString*>& aParameters);
+
   protected:
     /// The precedence of this rule.
     int iPrecedence;
@@ -139,6 +190,48 @@ public:
   /// expression with evaluated arguments.
   void Evaluate(LispPtr& aResult,LispEnvironment& aEnvironment, LispPtr& aArguments) const override;
 
+  /// Evaluate the function on arguments which are evaluated already.
+  /// \param aResult (on output) the result of the evaluation
+  /// \param aEnvironment the underlying Lisp environment
+  /// \param aArguments the arguments to the function
+  /// \param aEvaluated the evaluated arguments, or copies of the ones
+  /// on hold
+  ///
+  /// This is the second half of Evaluate(), which calls it after
+  /// evaluating the arguments: the parameters are declared and the
+  /// rules are tried. The predicates and bodies are evaluated through
+  /// their closures if LispClosure::Enabled(); the calls the bodies
+  /// leave in tail position are made here, in a loop. If the function
+  /// is Memoized(), the result is looked up first, and remembered.
+  void EvaluateRules(LispPtr& aResult, LispEnvironment& aEnvironment, LispPtr& aArguments, LispPtr* aEvaluated) const;
+
+  /// Declare the parameters, bound to \a aEvaluated, in the current
+  /// frame of local variables, and return the first rule which
+  /// matches, or nullptr if none does. The rules which can't match
+  /// the kinds of the arguments are skipped without trying them, and
+  /// if there are enough rules for Tree(), only the rules it finds
+  /// are tried.
+  BranchRuleBase* MatchRule(LispEnvironment& aEnvironment, LispPtr* aEvaluated) const;
+
+  /// The rule bases with at least this many rules look the arguments
+  /// up in a PatternTree.
+  static const std::size_t MIN_TREE_RULES = 4;
+
+  /// The number of arguments whose kinds MatchRule() works out for
+  /// the filters of the rules, see BranchRuleBase::MayMatch().
+  static const std::size_t MAX_FILTERED_ARGUMENTS = 4;
+
+  /// The distance between the numbers of rules added in order, see
+  /// NumberRule().
+  static const std::uint64_t ORDER_GAP = std::uint64_t(1) << 32;
+
+  /// The result when no rule matches: the call \a aArguments with the
+  /// arguments replaced by \a aEvaluated.
+  void Unevaluated(LispPtr& aResult, LispPtr& aArguments, LispPtr* aEvaluated) const;
+
+  /// Return true if argument \a aParameter is on hold.
+  bool Held(std::size_t aParameter) const;
+
   /// Put an argument on hold.
   /// \param aVariable name of argument to put un hold
   ///
@@ -168,29 +261,100 @@ public:
   /// This function does the real work for DeclareRule() and
   /// DeclarePattern(): it inserts the rule in #iRules, while
   /// keeping it sorted. The algorithm is \f$O(\log n)\f$, where
-  /// \f$n\f$ denotes the number of rules.
+  /// \f$n\f$ denotes the number of rules, apart from moving the rules
+  /// after it. The rule is numbered by NumberRule() and added to
+  /// Tree(), if it is there, and #iGeneration is incremented.
   void InsertRule(int aPrecedence,BranchRuleBase* newRule);
 
+  /// Give the rule at \a aIndex in #iRules a BranchRuleBase::iOrder
+  /// between those of its neighbours. If there is no room left between
+  /// them, the rules around it are numbered again as well. A rule
+  /// added last is numbered #ORDER_GAP after the one before it.
+  void NumberRule(std::size_t aIndex);
+
   /// Return the argument list, stored in #iParamList
   const LispPtr& ArgList() const override;
 
+  void Freeze(int aPrecision) override;
+  LispArityUserFunction* Clone() const override;
+
+  /// Remember the results of at most \a aLimit calls, see
+  /// LispMemoTable. The results remembered so far are kept, as far as
+  /// they fit.
+  void Memoize(std::size_t aLimit);
+
+  /// Stop remembering results, and forget them.
+  void UnMemoize();
+
+  /// Return true if the results are remembered.
+  bool Memoized() const { return !!iMemo; }
+
+  /// The results remembered, or nullptr if they are not.
+  const LispMemoTable* MemoTable() const { return iMemo.get(); }
+
+  void Forget() override;
+
 protected:
+  /// Copy constructor, the rules are cloned. The copy remembers
+  /// results if the original does, but starts with none.
+  BranchingUserFunction(const BranchingUserFunction& aOther);
+
+  /// Try the rules, making the calls in tail position, as
+  /// EvaluateRules() without the lookup in #iMemo.
+  void EvaluateCalls(LispPtr& aResult, LispEnvironment& aEnvironment, LispPtr& aArguments, LispPtr* aEvaluated) const;
+
+  /// The names of the parameters, for BranchRuleBase::Compile().
+  std::vector<const LispString*> ParameterNames() const;
+
+  /// The tree of the keys of the rules, or nullptr if there are fewer
+  /// than MIN_TREE_RULES rules. It is built when it is first needed,
+  /// or when the function is frozen, and InsertRule() adds to it. The
+  /// rules in the tree are numbered in the order they were added, see
+  /// #iAdded.
+  const PatternTree* Tree() const;
+
+  /// Try the rules once, as EvaluateRules(). Returns true if the body
+  /// of the rule which matched left a call in tail position in
+  /// \a aCall, which is for the caller to make once the local
+  /// variables are gone.
+  bool EvaluateRule(LispPtr& aResult, LispEnvironment& aEnvironment, LispPtr& aArguments, LispPtr* aEvaluated, LispClosure::TailCall& aCall) const;
+
   /// List of arguments, with corresponding \c iHold property.
   std::vector<BranchParameter> iParameters;
 
   /// List of rules, sorted on precedence.
   std::vector<BranchRuleBase*> iRules;
 
+  /// The rules in the order they were added, as numbered in Tree().
+  std::vector<BranchRuleBase*> iAdded;
+
+  /// Incremented whenever a rule is added, so that MatchRule() notices
+  /// a predicate adding one.
+  unsigned iGeneration;
+
+  /// See Tree().
+  mutable std::unique_ptr<PatternTree> iTree;
+
   /// List of arguments
   LispPtr iParamList;
+
+  /// The results remembered, see Memoize(). Shared with the calls in
+  /// progress, as a body may stop remembering.
+  std::shared_ptr<LispMemoTable> iMemo;
 };
 
+inline bool BranchingUserFunction::Held(std::size_t aParameter) const
+{
+    return iParameters[aParameter].iHold;
+}
+
 class ListedBranchingUserFunction final: public BranchingUserFunction
 {
 public:
   ListedBranchingUserFunction(LispPtr& aParameters);
   int IsArity(int aArity) const override;
   void Evaluate(LispPtr& aResult,LispEnvironment& aEnvironment, LispPtr& aArguments) const override;
+  LispArityUserFunction* Clone() const override;
 };
 
 
@@ -199,6 +363,7 @@ class MacroUserFunction : public BranchingUserFunction
 public:
   MacroUserFunction(LispPtr& aParameters);
   void Evaluate(LispPtr& aResult,LispEnvironment& aEnvironment, LispPtr& aArguments) const override;
+  LispArityUserFunction* Clone() const override;
 };
 
 
@@ -208,6 +373,7 @@ public:
   ListedMacroUserFunction(LispPtr& aParameters);
   int IsArity(int aArity) const override;
   void Evaluate(LispPtr& aResult,LispEnvironment& aEnvironment, LispPtr& aArguments) const override;
+  LispArityUserFunction* Clone() const override;
 };
 
 
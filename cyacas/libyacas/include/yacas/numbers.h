@@ -2,6 +2,7 @@
 #define YACAS_NUMBERS_H
 
 #include "lispenvironment.h"
+#include "anumber.h"
 
 /// Whether the numeric library supports 1.0E-10 and such.
 int NumericSupportForMantissa();
@@ -40,8 +41,6 @@ template<class T> inline T DIST(T x, T y) { return (x>=y+DIST_BITS || y>=x+DIST_
  */
 
 
-class ANumber;
-
 
 
 /// Main class for multiple-precision arithmetic.
@@ -53,7 +52,6 @@ public: //constructors
   BigNumber(const BigNumber& aOther);
   // no constructors from int or double to avoid automatic conversions
   BigNumber(int aPrecision = 20);
-  ~BigNumber();
   // assign from another number
   void SetTo(const BigNumber& aOther);
   // assign from string, precision in base digits
@@ -67,6 +65,8 @@ public: // Convert back to other types
   void ToString(LispString& aResult, int aPrecision, int aBase=10) const;
   /// Give approximate representation as a double number
   double Double() const;
+  /// Give exact representation as a long, if the number is an integer that fits
+  bool ToLong(long& aValue) const;
 
 public://basic object manipulation
   bool Equals(const BigNumber& aOther) const;
@@ -127,7 +127,7 @@ private:
     return *this;
   }
 public:
-  unsigned iReferenceCount;
+  ReferenceCount iReferenceCount;
 private:
   int iPrecision;
 
@@ -152,8 +152,12 @@ private:
     friend LispObject* SqrtFloat(LispObject* int1, LispEnvironment& aEnvironment,int aPrecision);
     friend LispObject* PowerFloat(LispObject* int1, LispObject* int2,
                            LispEnvironment& aEnvironment,int aPrecision);
+    /// always points to iStorage
     ANumber* iNumber;
   /// Internal library wrapper ends here.
+private:
+    /// the digits live inside the BigNumber, saving an allocation
+    ANumber iStorage;
 };
 
 /// bits_to_digits and digits_to_bits, utility functions
@@ -21,7 +21,17 @@ public:
   bool Matches(LispEnvironment& aEnvironment,
                       LispPtr* aArguments);
 
+  /// The variables of the pattern, see YacasPatternPredicateBase::Variables().
+  const std::vector<const LispString*>& Variables() const;
+
+  /// The filters of the parameters, see YacasPatternPredicateBase::Filters().
+  const std::vector<ArgumentFilter>& Filters() const;
+
+  /// The keys of the parameters, see YacasPatternPredicateBase::Keys().
+  std::vector<PatternKey> Keys() const;
+
   const char* TypeName() const override;
+  void Freeze(int aPrecision) override;
 
 protected:
   YacasPatternPredicateBase* iPatternMatcher;
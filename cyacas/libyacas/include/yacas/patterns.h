@@ -15,12 +15,118 @@
 
 
 #include "lisptype.h"
+#include "lispclosure.h"
 #include "lispenvironment.h"
 #include "noncopyable.h"
 #include "numbers.h"
 
+#include <memory>
 #include <vector>
 
+/// Cheap test of an expression, which rules out the patterns it
+/// can't possibly match before anything is evaluated.
+///
+/// The kind of an expression is one of INTEGER, FLOAT, ATOM (an atom
+/// which is not a number), LIST (any sublist) and OTHER (a generic
+/// object); its symbol is the name of an atom, or of the atom at the
+/// head of a list. A filter accepts a set of kinds and, optionally,
+/// only expressions with a given symbol.
+class ArgumentFilter {
+public:
+    enum {
+        INTEGER = 1,
+        FLOAT = 2,
+        ATOM = 4,
+        LIST = 8,
+        OTHER = 16,
+        NUMBER = INTEGER | FLOAT,
+        ANY = NUMBER | ATOM | LIST | OTHER
+    };
+
+    explicit ArgumentFilter(unsigned aKinds = ANY, const LispString* aSymbol = nullptr);
+
+    /// Return the kind of \a aExpression, leaving its symbol in
+    /// \a aSymbol. Whether a number is an integer is decided as
+    /// IsInteger() does, without converting the number.
+    static unsigned Kind(LispObject* aExpression, const LispString*& aSymbol);
+
+    /// Return true if an expression of kind \a aKind with symbol
+    /// \a aSymbol passes the filter.
+    bool Accepts(unsigned aKind, const LispString* aSymbol) const;
+
+    /// Return true if \a aExpression passes the filter.
+    bool Accepts(LispObject* aExpression) const;
+
+    /// Return true if every expression passes the filter.
+    bool AcceptsAll() const;
+
+    /// Narrow the filter down to the expressions which also pass
+    /// \a aOther.
+    void Restrict(const ArgumentFilter& aOther);
+
+    unsigned iKinds;
+    const LispString* iSymbol;
+};
+
+inline
+ArgumentFilter::ArgumentFilter(unsigned aKinds, const LispString* aSymbol):
+    iKinds(aKinds),
+    iSymbol(aSymbol)
+{
+}
+
+inline
+bool ArgumentFilter::Accepts(unsigned aKind, const LispString* aSymbol) const
+{
+    return (iKinds & aKind) && (!iSymbol || iSymbol == aSymbol);
+}
+
+inline
+bool ArgumentFilter::AcceptsAll() const
+{
+    return iKinds == ANY && !iSymbol;
+}
+
+/// One node of a pattern written in prefix order, see PatternTree.
+/// ANY stands for a variable, or anything else which may match any
+/// expression; a LIST of iLength elements is followed by their keys.
+/// An INTEGER is a number small enough for a long, any other number
+/// is a NUMBER.
+struct PatternKey {
+    enum Kind { ANY, ATOM, NUMBER, INTEGER, LIST };
+
+    explicit PatternKey(Kind aKind = ANY, const LispString* aSymbol = nullptr, std::size_t aLength = 0, long aValue = 0):
+        iKind(aKind), iSymbol(aSymbol), iLength(aLength), iValue(aValue) {}
+
+    Kind iKind;
+    /// the name of an ATOM
+    const LispString* iSymbol;
+    /// the number of elements of a LIST
+    std::size_t iLength;
+    /// the value of an INTEGER
+    long iValue;
+};
+
+/// The rest of a match, which a YacasParamMatcherBase calls once its
+/// part matches: it returns true if the rest matches as well. It only
+/// refers to a function object, which has to outlive it, so that
+/// passing one on doesn't allocate anything.
+class MatchContinuation {
+public:
+    template <typename F>
+    MatchContinuation(const F& aFunction):
+        iFunction(&aFunction),
+        iCall([](const void* aFunction) { return (*static_cast<const F*>(aFunction))(); })
+    {
+    }
+
+    bool operator()() const { return iCall(iFunction); }
+
+private:
+    const void* iFunction;
+    bool (*iCall)(const void*);
+};
+
 /// Abstract class for matching one argument to a pattern.
 class YacasParamMatcherBase {
 public:
@@ -35,6 +141,25 @@ public:
     virtual bool ArgumentMatches(LispEnvironment& aEnvironment,
                                  LispPtr& aExpression,
                                  LispPtr* arguments) const = 0;
+
+    /// Check whether some expression matches to the pattern, and the
+    /// rest of the match \a aNext with it. A pattern which can match
+    /// in several ways, see MatchACList, tries them until \a aNext
+    /// returns true, undoing the bindings of the ones which failed.
+    /// By default, the expression is matched as by the other overload.
+    virtual bool ArgumentMatches(LispEnvironment& aEnvironment,
+                                 LispPtr& aExpression,
+                                 LispPtr* arguments,
+                                 const MatchContinuation& aNext) const
+    {
+        return ArgumentMatches(aEnvironment, aExpression, arguments) && aNext();
+    }
+
+    /// A filter which accepts at least the expressions which match.
+    virtual ArgumentFilter Filter() const { return ArgumentFilter(); }
+
+    /// Append the keys of the pattern, in prefix order, to \a aKeys.
+    virtual void AppendKeys(std::vector<PatternKey>& aKeys) const { aKeys.emplace_back(); }
 };
 
 /// Class for matching an expression to a given atom.
@@ -45,6 +170,8 @@ public:
     bool ArgumentMatches(LispEnvironment& aEnvironment,
                          LispPtr& aExpression,
                          LispPtr* arguments) const override;
+    ArgumentFilter Filter() const override;
+    void AppendKeys(std::vector<PatternKey>& aKeys) const override;
 protected:
     const LispString* iString;
 };
@@ -63,13 +190,20 @@ public:
     bool ArgumentMatches(LispEnvironment& aEnvironment,
                          LispPtr& aExpression,
                          LispPtr* arguments) const override;
+    ArgumentFilter Filter() const override;
+    void AppendKeys(std::vector<PatternKey>& aKeys) const override;
 protected:
     RefPtr<BigNumber> iNumber;
+    /// iNumber as a small integer, valid only if iIsSmall is set
+    long iSmall;
+    bool iIsSmall;
 };
 
 inline
 MatchNumber::MatchNumber(BigNumber* aNumber):
-    iNumber(aNumber)
+    iNumber(aNumber),
+    iSmall(0),
+    iIsSmall(aNumber->ToLong(iSmall))
 {
 }
 
@@ -84,7 +218,23 @@ public:
         LispPtr& aExpression,
         LispPtr* arguments) const override;
 
+    bool ArgumentMatches(
+        LispEnvironment& aEnvironment,
+        LispPtr& aExpression,
+        LispPtr* arguments,
+        const MatchContinuation& aNext) const override;
+
+    ArgumentFilter Filter() const override;
+
+    void AppendKeys(std::vector<PatternKey>& aKeys) const override;
+
 protected:
+    /// Match #iMatchers from \a aIndex on to \a aElement and the
+    /// elements after it, and then \a aNext.
+    bool MatchElements(LispEnvironment& aEnvironment, LispPtr& aElement,
+                       std::size_t aIndex, LispPtr* arguments,
+                       const MatchContinuation& aNext) const;
+
     std::vector<const YacasParamMatcherBase*> iMatchers;
 };
 
@@ -101,6 +251,83 @@ MatchSubList::~MatchSubList()
         delete m;
 }
 
+/// Class for matching a call to an associative or commutative
+/// function, see LispEnvironment::SetAssociative() and
+/// LispEnvironment::SetCommutative().
+///
+/// If the function is associative, the operands of the pattern and of
+/// the expression are flattened first, so that \c _x+_y+_z stands for
+/// three operands, which \c a+(b+c) has as well. The last variable
+/// among the operands of the pattern then matches all the operands
+/// left over by the others, as an application of the function, so
+/// \c _x+_y matches \c a+b+c with \c y being \c b+c.
+///
+/// If the function is commutative, the operands are matched as
+/// multisets: every operand of the pattern is tried on the operands of
+/// the expression which pass its filter and are not taken yet, going
+/// back to the next choice when the rest doesn't match. The operands
+/// which aren't variables are tried first. The rest of the match
+/// includes the rest of the whole pattern, and an operand which is a
+/// call to a commutative function itself goes on with its next way of
+/// matching as well, see MatchContinuation.
+///
+/// Predicates other than tests of type are only checked once the whole
+/// pattern matched, so they don't make the operands be matched in
+/// another way. As the number of operands isn't fixed, the key of the
+/// pattern (see PatternTree) is ANY.
+class MatchACList final: public YacasParamMatcherBase, NonCopyable {
+public:
+    /// \param aFunction the head of the list
+    /// \param aAssociative, aCommutative the properties of \a aFunction
+    /// \param aOperands the matchers of the operands, flattened if
+    /// \a aAssociative
+    MatchACList(const LispString* aFunction, bool aAssociative, bool aCommutative,
+                std::vector<const YacasParamMatcherBase*>&& aOperands);
+    ~MatchACList() override;
+
+    /// Match the first way the operands match.
+    bool ArgumentMatches(
+        LispEnvironment& aEnvironment,
+        LispPtr& aExpression,
+        LispPtr* arguments) const override;
+
+    bool ArgumentMatches(
+        LispEnvironment& aEnvironment,
+        LispPtr& aExpression,
+        LispPtr* arguments,
+        const MatchContinuation& aNext) const override;
+
+    ArgumentFilter Filter() const override;
+
+private:
+    /// Match the operands from \a aIndex on in order, with #iRest
+    /// taking the ones in between, and then \a aNext.
+    bool MatchInOrder(LispEnvironment& aEnvironment, std::size_t aBase,
+                      std::size_t aCount, std::size_t aIndex,
+                      LispPtr* arguments, const MatchContinuation& aNext) const;
+
+    /// Match the operands from #iOrder[\a aIndex] on to the operands
+    /// of the expression which aren't taken yet, and then \a aNext.
+    bool MatchAnyOrder(LispEnvironment& aEnvironment, std::size_t aBase,
+                       std::size_t aCount, std::size_t aIndex,
+                       LispPtr* arguments, const MatchContinuation& aNext) const;
+
+    /// Match #iRest to the operands of the expression which aren't
+    /// taken yet, with \a aLeft of them left, and then \a aNext.
+    bool MatchRest(LispEnvironment& aEnvironment, std::size_t aBase,
+                   std::size_t aCount, std::size_t aLeft,
+                   LispPtr* arguments, const MatchContinuation& aNext) const;
+
+    const LispString* iFunction;
+    bool iAssociative;
+    bool iCommutative;
+    std::vector<const YacasParamMatcherBase*> iOperands;
+    /// the operands other than #iRest, in the order they are tried
+    std::vector<std::size_t> iOrder;
+    /// the operand taking the ones left over, or iOperands.size()
+    std::size_t iRest;
+};
+
 /// Class for matching against a pattern variable.
 class MatchVariable final: public YacasParamMatcherBase
 {
@@ -114,15 +341,29 @@ public:
     /// variables for \a aExpression.
     ///
     /// If entry #iVarIndex in \a arguments is still empty, the
-    /// pattern matches and \a aExpression is stored in this
-    /// entry. Otherwise, the pattern only matches if the entry equals
-    /// \a aExpression.
+    /// pattern matches if \a aExpression passes #iFilter, and
+    /// \a aExpression is stored in this entry, which is pushed on
+    /// LispEnvironment::iPatternTrail. Otherwise, the pattern only
+    /// matches if the entry equals \a aExpression.
     bool ArgumentMatches(LispEnvironment& aEnvironment,
                          LispPtr& aExpression,
                          LispPtr* arguments) const override;
+
+    ArgumentFilter Filter() const override;
+
+    /// Narrow #iFilter down, see ArgumentFilter::Restrict().
+    void Restrict(const ArgumentFilter& aFilter);
+
+    /// Index of variable in YacasPatternPredicateBase::iVariables.
+    int VarIndex() const;
+
 protected:
     /// Index of variable in YacasPatternPredicateBase::iVariables.
     int iVarIndex;
+
+    /// The test of the types of the variable by the predicates, for
+    /// the occurrence of the variable which binds it.
+    ArgumentFilter iFilter;
 };
 
 inline
@@ -131,6 +372,12 @@ MatchVariable::MatchVariable(int aVarIndex):
 {
 }
 
+inline
+int MatchVariable::VarIndex() const
+{
+    return iVarIndex;
+}
+
 /// Class that matches function arguments to a pattern.
 /// This class (specifically, the Matches() member function) can match
 /// function parameters to a pattern, check for predicates on the
@@ -156,14 +403,11 @@ public:
 
     /// Try to match the pattern against \a aArguments.
     /// First, every argument in \a aArguments is matched against the
-    /// corresponding YacasParamMatcherBase in #iParamMatches. If any
-    /// match fails, Matches() returns false. Otherwise, a temporary
-    /// LispLocalFrame is constructed, then SetPatternVariables() and
-    /// CheckPredicates() are called, and then the LispLocalFrame is
-    /// immediately deleted. If CheckPredicates() returns false, this
-    /// function also returns false. Otherwise, SetPatternVariables()
-    /// is called again, but now in the current LispLocalFrame, and
-    /// this function returns true.
+    /// corresponding YacasParamMatcherBase in #iParamMatches, which
+    /// bind the variables on LispEnvironment::iPatternBindings. If any
+    /// match fails, Matches() returns false. Otherwise, Bind() declares
+    /// the variables in the current LispLocalFrame and checks the
+    /// predicates.
     bool Matches(LispEnvironment& aEnvironment, LispPtr& aArguments);
 
     /// Try to match the pattern against \a aArguments.
@@ -171,6 +415,22 @@ public:
     /// but differs in the type of the arguments.
     bool Matches(LispEnvironment& aEnvironment, LispPtr* aArguments);
 
+    /// Freeze the predicates, see LispObject::Freeze().
+    void Freeze(int aPrecision);
+
+    /// The variables appearing in the pattern, in the order
+    /// SetPatternVariables() declares them.
+    const std::vector<const LispString*>& Variables() const;
+
+    /// A filter for every parameter, accepting at least the arguments
+    /// which can match it. Tests of the type of a variable, such as
+    /// the one in \c x_IsNumber, are part of the filters, so they are
+    /// made before any predicate is evaluated.
+    const std::vector<ArgumentFilter>& Filters() const;
+
+    /// The keys of the parameters in prefix order, see PatternTree.
+    std::vector<PatternKey> Keys() const;
+
 protected:
     /// Construct a pattern matcher out of a Lisp expression.
     /// The result of this function depends on the value of \a aPattern:
@@ -188,10 +448,17 @@ protected:
     /// - If \a aPattern is a list of another form, this function
     ///   calls itself on any of the entries in this list. The
     ///   resulting YacasParamMatcherBase objects are collected in a
-    ///   MatchSubList, which is returned.
+    ///   MatchSubList, which is returned, or in a MatchACList if the
+    ///   head of the list is an associative or commutative function.
     /// - Otherwise, this function returns #nullptr.
     const YacasParamMatcherBase* MakeParamMatcher(LispEnvironment& aEnvironment, LispObject* aPattern);
 
+    /// Turn the predicates which test the type of a variable into
+    /// filters of the MatchVariable in #iOccurrences. A predicate which is
+    /// nothing but such a test, like the ones of \c x_IsNumber, is
+    /// removed from #iPredicates, as the filter gives the same answer.
+    void FilterPredicates(LispEnvironment& aEnvironment);
+
     /// Look up a variable name in #iVariables
     /// \returns index in #iVariables array where \a aVariable
     /// appears.
@@ -206,9 +473,25 @@ protected:
     /// corresponding argument is assigned to it.
     void SetPatternVariables(LispEnvironment& aEnvironment, LispPtr* arguments);
 
+    /// Call SetPatternVariables(), then CheckPredicates(). If a
+    /// predicate is false, the variables are dropped again and false
+    /// is returned. Local variables the predicates declare are
+    /// dropped in any case.
+    bool Bind(LispEnvironment& aEnvironment, LispPtr* arguments);
+
+    /// Match #iParamMatchers from \a aIndex on to \a aArguments, going
+    /// through the ways a MatchACList among them matches.
+    bool MatchParameters(LispEnvironment& aEnvironment, LispPtr* aArguments,
+                         std::size_t aIndex, LispPtr* arguments) const;
+
+    /// The same for arguments in a list, from \a aArgument on.
+    bool MatchParameterList(LispEnvironment& aEnvironment, LispPtr& aArgument,
+                            std::size_t aIndex, LispPtr* arguments) const;
+
     /// Check whether all predicates are true.
     /// This function goes through all predicates in #iPredicates, and
-    /// evaluates them. It returns #false if at least one
+    /// evaluates them, through #iCompiledPredicates if
+    /// LispClosure::Enabled(). It returns #false if at least one
     /// of these results IsFalse(). An error is raised if any result
     /// neither IsTrue() nor IsFalse().
     bool CheckPredicates(LispEnvironment& aEnvironment);
@@ -222,6 +505,20 @@ protected:
 
     /// List of predicates which need to be true for a match.
     std::vector<LispPtr> iPredicates;
+
+    /// #iPredicates compiled, with #iVariables as the slots.
+    std::vector<std::shared_ptr<const LispClosure>> iCompiledPredicates;
+
+    /// Every occurrence of a variable. Which one binds it depends on
+    /// the order MatchACList tries the operands in.
+    std::vector<MatchVariable*> iOccurrences;
+
+    /// The filters of the parameters, see Filters().
+    std::vector<ArgumentFilter> iFilters;
+
+    /// Whether the pattern has a MatchACList, which may match in more
+    /// than one way.
+    bool iBacktracks;
 };
 
 
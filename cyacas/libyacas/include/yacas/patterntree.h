@@ -0,0 +1,63 @@
+/** \file patterntree.h
+ *  Finding the rules whose patterns may match, in one pass over the
+ *  arguments.
+ *
+ * class PatternTree. The patterns of the rules of a rule base, written
+ * in prefix order as sequences of PatternKey, are merged into a
+ * discrimination tree: the patterns which start out the same share a
+ * path from the root. Looking up the arguments walks the tree once,
+ * following at every node the edge of the expression at hand (its
+ * atom, its value if it is a small integer, any number, or a list of
+ * its length) as well as the edge of a variable, which skips the
+ * expression. The rules at the leaves reached are the ones whose
+ * patterns may match; the patterns and the predicates are then tried
+ * on these only.
+ *
+ * The edges of atoms and small integers are hashed, so a rule base
+ * which is a table of values, like f(1), f(2), ..., finds the rule
+ * for the arguments in constant time.
+ *
+ * The tree doesn't know about predicates, or about variables which
+ * occur more than once, so a rule it returns may still not match.
+ */
+
+#ifndef YACAS_PATTERNTREE_H
+#define YACAS_PATTERNTREE_H
+
+#include "lispobject.h"
+#include "noncopyable.h"
+#include "patterns.h"
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class PatternTree: NonCopyable {
+public:
+    PatternTree();
+    ~PatternTree();
+
+    /// Add rule number \a aRule, whose pattern has the keys \a aKeys.
+    void Insert(const std::vector<PatternKey>& aKeys, std::size_t aRule);
+
+    /// Append the numbers of the rules whose patterns may match the
+    /// \a aCount arguments \a aArguments to \a aRules, in no
+    /// particular order. \a aTerms is scratch space, which is left as
+    /// it was.
+    void Find(const LispPtr* aArguments, std::size_t aCount,
+              std::vector<std::size_t>& aRules,
+              std::vector<LispObject*>& aTerms) const;
+
+    /// A node of the tree, only known to patterntree.cpp.
+    struct Node;
+
+private:
+    static void Collect(const Node& aNode, std::size_t aBase,
+                        std::vector<std::size_t>& aRules,
+                        std::vector<LispObject*>& aTerms);
+
+    std::unique_ptr<Node> iRoot;
+};
+
+#endif
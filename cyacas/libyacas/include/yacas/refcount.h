@@ -3,8 +3,75 @@
 
 #include <cassert>
 
+#if defined(YACAS_ATOMIC_REFCOUNT)
+# if defined(YACAS_NO_ATOMIC_TYPES)
+#  error "atomic reference counts require atomic types"
+# endif
+# include <atomic>
+#endif
+
 #include "lisptype.h"
 
+//------------------------------------------------------------------------------
+// ReferenceCount - the reference count embedded in reference counted objects
+// as iReferenceCount.
+//
+// The counting policy is chosen at build time: a plain unsigned by default,
+// or an atomic counter if YACAS_ATOMIC_REFCOUNT is defined (cmake option
+// ENABLE_ATOMIC_REFCOUNT), which allows RefPtrs to the same object to be
+// created and dropped from several threads.
+//
+// A count can be frozen. A frozen object is immortal: its count is never
+// touched again, so it is never deleted and sharing it between threads
+// costs no synchronization (nor writes to its cache line), whatever the
+// policy.
+
+class ReferenceCount {
+public:
+  ReferenceCount() : iCount(0) {}
+  // a copy of an object is not referenced by the references to the original
+  ReferenceCount(const ReferenceCount&) : iCount(0) {}
+  ReferenceCount& operator=(const ReferenceCount&) { return *this; }
+
+  void operator++()
+  {
+    if (!IsFrozen())
+      Increment();
+  }
+
+  void operator++(int) { ++*this; }
+
+  // Returns the decremented count, which is never zero for frozen objects.
+  unsigned operator--()
+  {
+    if (IsFrozen())
+      return FROZEN;
+    return Decrement();
+  }
+
+  operator unsigned() const { return Load(); }
+
+  void Freeze() { iCount = FROZEN; }
+  bool IsFrozen() const { return (Load() & FROZEN) != 0; }
+
+private:
+  static const unsigned FROZEN = 1u << (8 * sizeof(unsigned) - 1);
+
+#if defined(YACAS_ATOMIC_REFCOUNT)
+  unsigned Load() const { return iCount.load(std::memory_order_relaxed); }
+  void Increment() { iCount.fetch_add(1, std::memory_order_relaxed); }
+  unsigned Decrement() { return iCount.fetch_sub(1, std::memory_order_acq_rel) - 1; }
+
+  std::atomic<unsigned> iCount;
+#else
+  unsigned Load() const { return iCount; }
+  void Increment() { ++iCount; }
+  unsigned Decrement() { return --iCount; }
+
+  unsigned iCount;
+#endif
+};
+
 //------------------------------------------------------------------------------
 // RefPtr - Smart pointer for (intrusive) reference counting.
 // Simply, an object's reference count is the number of RefPtrs refering to it.
@@ -24,13 +91,14 @@ public:
   explicit RefPtr(T *ptr) : iPtr(ptr) { if (ptr) { ptr->iReferenceCount++; } }
   // Copy constructor
   RefPtr(const RefPtr &refPtr) : iPtr(refPtr.ptr()) { if (iPtr) { iPtr->iReferenceCount++; } }
+  // Move constructor, the reference is taken over and the count untouched
+  RefPtr(RefPtr &&refPtr) noexcept : iPtr(refPtr.release()) {}
   // Destructor
   ~RefPtr()
   {
     if (iPtr)
     {
-      iPtr->iReferenceCount--;
-      if (iPtr->iReferenceCount == 0)
+      if (--iPtr->iReferenceCount == 0)
       {
         delete iPtr;
       }
@@ -45,8 +113,7 @@ public:
     }
     if (iPtr)
     {
-      iPtr->iReferenceCount--;
-      if (iPtr->iReferenceCount == 0)
+      if (--iPtr->iReferenceCount == 0)
       {
         delete iPtr;
       }
@@ -56,6 +123,20 @@ public:
   }
   // Assignment from another
   RefPtr &operator=(const RefPtr &refPtr) { return this->operator=(refPtr.ptr()); }
+  // Move assignment, the reference is taken over and the count untouched
+  RefPtr &operator=(RefPtr &&refPtr) noexcept
+  {
+    T *ptr = refPtr.release();
+    if (iPtr)
+    {
+      if (--iPtr->iReferenceCount == 0)
+      {
+        delete iPtr;
+      }
+    }
+    iPtr = ptr;
+    return *this;
+  }
 
   operator T*()    const { return  iPtr; }  // implicit conversion to pointer to T
   T &operator*()   const { return *iPtr; }  // so (*refPtr) is a reference to T
@@ -63,6 +144,10 @@ public:
   T *ptr()         const { return  iPtr; }  // so (refPtr.ptr()) returns the pointer to T (boost calls this method 'get')
   bool operator!() const { return !iPtr; }  // is null pointer
 
+  // Give up the reference without decrementing the count, the caller
+  // becomes responsible for it.
+  T *release() { T *ptr = iPtr; iPtr = nullptr; return ptr; }
+
 private:
    T *iPtr;
 };
@@ -0,0 +1,194 @@
+/** \file smallvector.h
+ *  A vector that keeps a few elements inline.
+ *
+ * class SmallVector. A subset of the std::vector interface for trivial
+ * element types, which stores up to N elements inside the object
+ * itself and only goes to the heap when it grows beyond that. The heap
+ * storage comes from the current LispArena, so that it is accounted
+ * for (and limited) with the rest of the memory of the environment.
+ */
+
+#ifndef YACAS_SMALLVECTOR_H
+#define YACAS_SMALLVECTOR_H
+
+#include "lisparena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+template <typename T, std::size_t N>
+class SmallVector {
+    static_assert(std::is_trivial<T>::value, "SmallVector only holds trivial types");
+
+public:
+    typedef T value_type;
+    typedef std::size_t size_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    SmallVector(): iData(iInline), iSize(0), iCapacity(N) {}
+
+    SmallVector(const SmallVector& aOther): iData(iInline), iSize(0), iCapacity(N)
+    {
+        assign(aOther.begin(), aOther.end());
+    }
+
+    ~SmallVector()
+    {
+        if (iData != iInline)
+            LispArena::Delete(iData, iCapacity * sizeof(T));
+    }
+
+    SmallVector& operator=(const SmallVector& aOther)
+    {
+        if (this != &aOther)
+            assign(aOther.begin(), aOther.end());
+        return *this;
+    }
+
+    void assign(const_iterator aFirst, const_iterator aLast)
+    {
+        const size_type n = aLast - aFirst;
+        reserve(n);
+        std::memmove(iData, aFirst, n * sizeof(T));
+        iSize = n;
+    }
+
+    size_type size() const { return iSize; }
+    size_type capacity() const { return iCapacity; }
+    bool empty() const { return iSize == 0; }
+
+    reference operator[](size_type i) { assert(i < iSize); return iData[i]; }
+    const_reference operator[](size_type i) const { assert(i < iSize); return iData[i]; }
+
+    reference at(size_type i)
+    {
+        if (i >= iSize)
+            throw std::out_of_range("SmallVector::at");
+        return iData[i];
+    }
+
+    const_reference at(size_type i) const
+    {
+        if (i >= iSize)
+            throw std::out_of_range("SmallVector::at");
+        return iData[i];
+    }
+
+    reference front() { assert(iSize); return iData[0]; }
+    const_reference front() const { assert(iSize); return iData[0]; }
+    reference back() { assert(iSize); return iData[iSize - 1]; }
+    const_reference back() const { assert(iSize); return iData[iSize - 1]; }
+
+    T* data() { return iData; }
+    const T* data() const { return iData; }
+
+    iterator begin() { return iData; }
+    const_iterator begin() const { return iData; }
+    iterator end() { return iData + iSize; }
+    const_iterator end() const { return iData + iSize; }
+
+    void clear() { iSize = 0; }
+
+    void reserve(size_type aCapacity)
+    {
+        if (aCapacity <= iCapacity)
+            return;
+
+        size_type capacity = 2 * iCapacity;
+        if (capacity < aCapacity)
+            capacity = aCapacity;
+
+        T* data = static_cast<T*>(LispArena::New(capacity * sizeof(T)));
+
+        std::memcpy(data, iData, iSize * sizeof(T));
+
+        if (iData != iInline)
+            LispArena::Delete(iData, iCapacity * sizeof(T));
+
+        iData = data;
+        iCapacity = capacity;
+    }
+
+    void resize(size_type aSize, const T& aValue = T())
+    {
+        if (aSize > iSize) {
+            reserve(aSize);
+            std::fill(iData + iSize, iData + aSize, aValue);
+        }
+        iSize = aSize;
+    }
+
+    void push_back(const T& aValue)
+    {
+        if (iSize == iCapacity) {
+            // aValue may refer to an element of this vector
+            const T value = aValue;
+            reserve(iSize + 1);
+            iData[iSize++] = value;
+        } else {
+            iData[iSize++] = aValue;
+        }
+    }
+
+    void pop_back() { assert(iSize); --iSize; }
+
+    iterator insert(const_iterator aPosition, const T& aValue)
+    {
+        return insert(aPosition, 1, aValue);
+    }
+
+    iterator insert(const_iterator aPosition, size_type aCount, const T& aValue)
+    {
+        const size_type offset = aPosition - iData;
+        assert(offset <= iSize);
+
+        const T value = aValue;
+        reserve(iSize + aCount);
+
+        T* position = iData + offset;
+        std::memmove(position + aCount, position, (iSize - offset) * sizeof(T));
+        std::fill(position, position + aCount, value);
+        iSize += aCount;
+
+        return position;
+    }
+
+    iterator erase(const_iterator aFirst, const_iterator aLast)
+    {
+        const size_type first = aFirst - iData;
+        const size_type last = aLast - iData;
+        assert(first <= last && last <= iSize);
+
+        std::memmove(iData + first, iData + last, (iSize - last) * sizeof(T));
+        iSize -= last - first;
+
+        return iData + first;
+    }
+
+    iterator erase(const_iterator aPosition)
+    {
+        return erase(aPosition, aPosition + 1);
+    }
+
+    void swap(SmallVector& aOther)
+    {
+        SmallVector tmp(aOther);
+        aOther = *this;
+        *this = tmp;
+    }
+
+private:
+    T* iData;
+    size_type iSize;
+    size_type iCapacity;
+    T iInline[N];
+};
+
+#endif
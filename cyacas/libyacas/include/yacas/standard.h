@@ -23,6 +23,7 @@ void InternalAssociate(LispPtr& aResult, const LispPtr& aKey,
 
 void InternalReverseList(LispPtr& aResult, const LispPtr& aOriginal);
 void InternalFlatCopy(LispPtr& aResult, const LispPtr& aOriginal);
+void InternalDeepCopy(LispPtr& aResult, const LispPtr& aOriginal);
 std::size_t InternalListLength(const LispPtr& aOriginal);
 
 bool InternalStrictTotalOrder(const LispEnvironment& env,
@@ -1,5 +1,18 @@
-
 /** \file stubs.h interface to platform-dependent functions
+ *
+ * PlatAlloc, PlatReAlloc and PlatFree are the allocator used for the
+ * memory of the engine (the chunks of the arenas, number digits and
+ * so on). The backend is chosen at build time (CYACAS_ALLOCATOR in
+ * cmake):
+ *
+ * - YACAS_THREAD_CACHE_ALLOC: PlatTcAlloc, a thread-caching allocator
+ *   (tcalloc.cpp) for engines running on several threads at once.
+ *   Every thread allocates from its own cache without locking, blocks
+ *   freed by other threads are handed back through a lock-free queue.
+ * - YACAS_SYSTEM_ALLOC, or NO_GLOBALS: malloc.
+ * - otherwise obmalloc (defines YACAS_OBMALLOC), which is only
+ *   thread-safe after PlatObSetThreadSafe(true) and then serializes
+ *   all the threads on a single mutex.
  */
 
 #ifndef YACAS_STUBS_H
@@ -7,7 +20,15 @@
 
 #include <cstddef>
 
-#ifdef NO_GLOBALS
+#if defined(YACAS_THREAD_CACHE_ALLOC)
+  void* PlatTcAlloc(std::size_t aNrBytes);
+  void* PlatTcReAlloc(void* aOrig, std::size_t aNrBytes);
+  void PlatTcFree(void* aOrig);
+
+  #define PlatAlloc PlatTcAlloc
+  #define PlatReAlloc PlatTcReAlloc
+  #define PlatFree PlatTcFree
+#elif defined(NO_GLOBALS) || defined(YACAS_SYSTEM_ALLOC)
   void* PlatStubAlloc(std::size_t aNrBytes);
   void* PlatStubReAlloc(void* aOrig, std::size_t aNrBytes);
   void PlatStubFree(void* aOrig);
@@ -16,6 +37,8 @@
   #define PlatReAlloc PlatStubReAlloc
   #define PlatFree PlatStubFree
 #else
+  #define YACAS_OBMALLOC
+
   void* PlatObAlloc(std::size_t nbytes);
   void PlatObFree(void *p);
   void* PlatObReAlloc(void *p, std::size_t nbytes);
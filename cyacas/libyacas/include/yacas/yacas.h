@@ -11,6 +11,7 @@
 #include "lispevalhash.h"
 #include "infixparser.h"
 #include "platfileio.h"
+#include "lisparena.h"
 #include "lispatom.h"
 #include "lispeval.h"
 #include "lispglobals.h"
@@ -18,6 +19,8 @@
 #include "lispuserfunc.h"
 #include "noncopyable.h"
 
+#include <chrono>
+#include <memory>
 #include <sstream>
 
 
@@ -31,9 +34,18 @@ class DefaultYacasEnvironment: NonCopyable
 {
 public:
   explicit DefaultYacasEnvironment(std::ostream&);
+  /// Construct an environment sharing the definitions of the frozen
+  /// environment \p aFrozen, see LispEnvironment::Attach().
+  DefaultYacasEnvironment(std::ostream&, const DefaultYacasEnvironment& aFrozen);
+  ~DefaultYacasEnvironment();
   LispEnvironment& getEnv() {return iEnvironment;}
+  LispArena& getArena() {return *arena;}
 
 private:
+  // declared first, so that it outlives all the objects allocated
+  // from it; objects escaping the environment keep it alive
+  std::unique_ptr<LispArena, LispArena::Releaser> arena;
+
   std::ostream& output;
   LispHashTable hash;
   LispPrinter printer;
@@ -71,16 +83,40 @@ public:
     /// Constructor
     explicit CYacas(std::ostream&);
 
+    /// Construct an engine which starts out with the definitions of
+    /// \p aFrozen, which has to be frozen. Nothing is parsed again,
+    /// the rules are shared (copy-on-write) with \p aFrozen and with
+    /// all the other engines attached to it.
+    CYacas(std::ostream&, const CYacas& aFrozen);
+
+    /// Freeze the engine, typically after the standard scripts are
+    /// loaded. Everything defined so far becomes immortal and
+    /// read-only (reference counting is skipped for it) and can be
+    /// shared by new engines, see CYacas(std::ostream&, const CYacas&).
+    ///
+    /// A frozen engine only serves as the base of the engines attached
+    /// to it, and doesn't evaluate anything anymore: the atoms it
+    /// would create are not frozen, and would be shared by the
+    /// engines attached later, whose reference counts aren't
+    /// synchronized.
+    void Freeze();
+
     /// Return the underlying Yacas environment.
     DefaultYacasEnvironment& getDefEnv() {return environment;}
 
-    /// Evaluate a Yacas expression.
-    /// First, \p aExpression is parsed by an InfixParser. Then it is
+    /// Evaluate a Yacas expression. In a frozen engine this only sets
+    /// the error, see Freeze(). First, \p aExpression is parsed by an InfixParser. Then it is
     /// evaluated in the underlying Lisp environment. Finally, the
     /// result is printed to #iResultOutput via the pretty printer or,
     /// if this is not defined, via an InfixPrinter.
     void Evaluate(const std::string& aExpression);
 
+    /// Evaluate a Yacas expression as Evaluate() does, but give up
+    /// once \p aTimeout has passed. The evaluation then fails with
+    /// the error "Evaluation timed out".
+    void EvaluateWithTimeout(const std::string& aExpression,
+                             std::chrono::steady_clock::duration aTimeout);
+
     /// Return the result of the expression.
     /// This is stored in #iResult.
     const std::string& Result() const;
@@ -92,6 +128,9 @@ public:
     /// Whether an error occured during the last evaluation.
     bool IsError() const;
 
+    /// Whether Freeze() was called.
+    bool IsFrozen() const;
+
 private:
 
     /// The underlying Yacas environment
@@ -99,6 +138,8 @@ private:
 
     std::string _result;
     std::string _error;
+
+    bool _frozen;
 };
 
 inline
@@ -119,4 +160,10 @@ bool CYacas::IsError() const
     return !Error().empty();
 }
 
+inline
+bool CYacas::IsFrozen() const
+{
+    return _frozen;
+}
+
 #endif
@@ -0,0 +1,376 @@
+
+#include "yacas/lisparena.h"
+#include "yacas/lisperror.h"
+#include "yacas/lispobject.h"
+#include "yacas/stubs.h"
+
+#include <cassert>
+#include <new>
+#include <utility>
+
+namespace {
+    // every block is preceded by a header pointing to its region
+    const std::size_t HEADER_SIZE = 8;
+    const std::size_t GRANULARITY = 8;
+    // blocks up to this size (including the header) are served from
+    // the size-class free lists, larger ones go directly to PlatAlloc
+    const std::size_t MAX_SMALL_SIZE = 256;
+    const std::size_t CHUNK_SIZE = 64 * 1024;
+
+    inline std::size_t RoundUp(std::size_t n)
+    {
+        return (n + GRANULARITY - 1) & ~(GRANULARITY - 1);
+    }
+}
+
+struct LispArena::Region {
+    enum Kind {
+        KHeap,
+        KLarge,
+        KScratch
+    };
+
+    Region(LispArena* aArena, Kind aKind):
+        iArena(aArena), iKind(aKind), iLive(0),
+        iBase(nullptr), iTop(nullptr), iEnd(nullptr) {}
+
+    LispArena* iArena;
+    Kind iKind;
+    // number of live blocks, only maintained for scratch regions
+    std::size_t iLive;
+    char* iBase;
+    char* iTop;
+    char* iEnd;
+};
+
+thread_local LispArena* LispArena::iCurrent = nullptr;
+
+LispArena::LispArena():
+    iHeap(new Region(this, Region::KHeap)),
+    iLarge(new Region(this, Region::KLarge)),
+    iScratch(nullptr),
+    iSpare(nullptr),
+    iFreeLists(MAX_SMALL_SIZE / GRANULARITY + 1, nullptr),
+    iTop(nullptr),
+    iEnd(nullptr),
+    iScratchSize(0),
+    iMemoryLimit(0),
+    iMemoryLimitReached(false),
+    iLimitSignalled(false),
+    iLiveBlocks(0),
+    iEvaluationDepth(0),
+    iReleased(false)
+{
+    static_assert(HEADER_SIZE >= sizeof(Region*), "arena block header too small");
+}
+
+LispArena::~LispArena()
+{
+    assert(iLiveBlocks == 0);
+
+    for (char* chunk: iChunks)
+        PlatFree(chunk);
+
+    FreeRegion(iScratch);
+    FreeRegion(iSpare);
+
+    delete iLarge;
+    delete iHeap;
+}
+
+void LispArena::Release()
+{
+    bool dispose;
+
+    {
+        const Guard guard = Lock();
+        iReleased = true;
+        dispose = !iLiveBlocks;
+    }
+
+    if (dispose)
+        delete this;
+}
+
+void LispArena::SetScratchSize(std::size_t aBytes)
+{
+    const Guard guard = Lock();
+
+    iScratchSize = RoundUp(aBytes);
+
+    if (iScratch && iScratch->iLive)
+        RetireScratch();
+
+    FreeRegion(iScratch);
+    FreeRegion(iSpare);
+    iScratch = nullptr;
+    iSpare = nullptr;
+}
+
+void LispArena::SetMemoryLimit(std::size_t aBytes)
+{
+    const Guard guard = Lock();
+
+    iMemoryLimit = aBytes;
+    iMemoryLimitReached = false;
+}
+
+void LispArena::SetLimitHandler(std::function<void()> aHandler)
+{
+    const Guard guard = Lock();
+
+    iLimitHandler = std::move(aHandler);
+}
+
+bool LispArena::TakeLimitSignal()
+{
+    const Guard guard = Lock();
+
+    const bool signalled = iLimitSignalled;
+    iLimitSignalled = false;
+    return signalled;
+}
+
+void LispArena::BeginEvaluation()
+{
+    const Guard guard = Lock();
+
+    if (iEvaluationDepth++)
+        return;
+
+    iStats.evaluation_allocations = 0;
+    iLimitSignalled = false;
+
+    if (iScratchSize && !iScratch) {
+        if (iSpare) {
+            iScratch = iSpare;
+            iSpare = nullptr;
+        } else {
+            iScratch = new Region(this, Region::KScratch);
+            iScratch->iBase = static_cast<char*>(PlatAlloc(iScratchSize));
+            iScratch->iEnd = iScratch->iBase + iScratchSize;
+        }
+        iScratch->iTop = iScratch->iBase;
+    }
+}
+
+void LispArena::EndEvaluation()
+{
+    const Guard guard = Lock();
+
+    assert(iEvaluationDepth > 0);
+
+    if (--iEvaluationDepth)
+        return;
+
+    if (!iScratch)
+        return;
+
+    // Something allocated during the evaluation is still referenced
+    // (it ended up in a global, a rule or the result). The region is
+    // freed only when the last such block goes away.
+    if (iScratch->iLive)
+        RetireScratch();
+    else
+        iScratch->iTop = iScratch->iBase;
+}
+
+void LispArena::RetireScratch()
+{
+    assert(iScratch && iScratch->iLive);
+    iScratch = nullptr;
+}
+
+void LispArena::FreeRegion(Region* aRegion)
+{
+    if (!aRegion)
+        return;
+
+    assert(aRegion->iLive == 0);
+
+    PlatFree(aRegion->iBase);
+    delete aRegion;
+}
+
+void* LispArena::AllocateFromHeap(std::size_t aTotal)
+{
+    void*& head = iFreeLists[aTotal / GRANULARITY];
+
+    if (head) {
+        void* block = head;
+        head = *static_cast<void**>(block);
+        return block;
+    }
+
+    if (iTop + aTotal > iEnd) {
+        // the tail of the old chunk is handed out to the free lists
+        // so that it isn't wasted
+        while (iTop && iEnd - iTop >= static_cast<std::ptrdiff_t>(GRANULARITY + HEADER_SIZE)) {
+            const std::size_t n = iEnd - iTop > static_cast<std::ptrdiff_t>(MAX_SMALL_SIZE) ? MAX_SMALL_SIZE : iEnd - iTop;
+            void*& list = iFreeLists[n / GRANULARITY];
+            *reinterpret_cast<void**>(iTop) = list;
+            list = iTop;
+            iTop += n;
+        }
+
+        char* chunk = static_cast<char*>(PlatAlloc(CHUNK_SIZE));
+        if (!chunk)
+            throw std::bad_alloc();
+        iChunks.push_back(chunk);
+        iTop = chunk;
+        iEnd = chunk + CHUNK_SIZE;
+    }
+
+    void* block = iTop;
+    iTop += aTotal;
+    return block;
+}
+
+void* LispArena::Allocate(std::size_t aTotal)
+{
+    bool full;
+
+    {
+        const Guard guard = Lock();
+        full = iMemoryLimit && iStats.live_bytes + aTotal > iMemoryLimit;
+    }
+
+    // the objects waiting to be freed (see LispObject::Reclaim()) are
+    // still counted as live, they go first
+    if (full)
+        LispObject::Reclaim();
+
+    const Guard guard = Lock();
+
+    if (iMemoryLimit) {
+        const std::size_t live = iStats.live_bytes + aTotal;
+        if (live <= iMemoryLimit) {
+            iMemoryLimitReached = false;
+        } else if (!iMemoryLimitReached) {
+            iMemoryLimitReached = true;
+            if (!iLimitHandler)
+                throw LispErrMaxMemoryReached();
+            // the allocation goes ahead, the evaluation is stopped at
+            // its next safepoint
+            iLimitSignalled = true;
+            iLimitHandler();
+        } else if (live > iMemoryLimit + iMemoryLimit / 8) {
+            // the error is delivered here already
+            iLimitSignalled = false;
+            throw LispErrMaxMemoryReached();
+        }
+    }
+
+    Region* region;
+    void* block;
+
+    if (aTotal > MAX_SMALL_SIZE) {
+        block = PlatAlloc(aTotal);
+        if (!block)
+            throw std::bad_alloc();
+        region = iLarge;
+    } else if (iScratch && iScratch->iTop + aTotal <= iScratch->iEnd) {
+        block = iScratch->iTop;
+        iScratch->iTop += aTotal;
+        iScratch->iLive += 1;
+        region = iScratch;
+    } else {
+        block = AllocateFromHeap(aTotal);
+        region = iHeap;
+    }
+
+    iLiveBlocks += 1;
+
+    iStats.allocations += 1;
+    iStats.evaluation_allocations += 1;
+    iStats.live_bytes += aTotal;
+    if (iStats.live_bytes > iStats.peak_bytes)
+        iStats.peak_bytes = iStats.live_bytes;
+
+    *static_cast<Region**>(block) = region;
+
+    return static_cast<char*>(block) + HEADER_SIZE;
+}
+
+bool LispArena::Deallocate(Region* aRegion, void* aBlock, std::size_t aTotal)
+{
+    const Guard guard = Lock();
+
+    switch (aRegion->iKind) {
+    case Region::KHeap: {
+        void*& head = iFreeLists[aTotal / GRANULARITY];
+        *static_cast<void**>(aBlock) = head;
+        head = aBlock;
+        break;
+    }
+    case Region::KLarge:
+        PlatFree(aBlock);
+        break;
+    case Region::KScratch:
+        if (--aRegion->iLive == 0) {
+            if (aRegion == iScratch) {
+                aRegion->iTop = aRegion->iBase;
+            } else if (!iSpare && !iReleased &&
+                       aRegion->iEnd - aRegion->iBase == static_cast<std::ptrdiff_t>(iScratchSize)) {
+                iSpare = aRegion;
+            } else {
+                FreeRegion(aRegion);
+            }
+        }
+        break;
+    }
+
+    iStats.live_bytes -= aTotal;
+
+    return --iLiveBlocks == 0 && iReleased;
+}
+
+void* LispArena::New(std::size_t aSize)
+{
+    const std::size_t total = RoundUp(aSize + HEADER_SIZE);
+
+    if (LispArena* arena = iCurrent)
+        return arena->Allocate(total);
+
+    void* block = PlatAlloc(total);
+    if (!block)
+        throw std::bad_alloc();
+
+    *static_cast<Region**>(block) = nullptr;
+
+    return static_cast<char*>(block) + HEADER_SIZE;
+}
+
+void LispArena::Delete(void* aObject, std::size_t aSize)
+{
+    if (!aObject)
+        return;
+
+    void* block = static_cast<char*>(aObject) - HEADER_SIZE;
+
+    Region* region = *static_cast<Region**>(block);
+
+    if (!region) {
+        PlatFree(block);
+        return;
+    }
+
+    LispArena* arena = region->iArena;
+
+    if (arena->Deallocate(region, block, RoundUp(aSize + HEADER_SIZE)))
+        delete arena;
+}
+
+LispArenaScope::LispArenaScope(LispArena& aArena):
+    iArena(aArena),
+    iPrevious(LispArena::iCurrent)
+{
+    LispArena::iCurrent = &iArena;
+    iArena.BeginEvaluation();
+}
+
+LispArenaScope::~LispArenaScope()
+{
+    iArena.EndEvaluation();
+    LispArena::iCurrent = iPrevious;
+}
@@ -6,6 +6,10 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <limits>
+#include <string>
+#include <vector>
 
 /// construct an atom from a string representation.
 LispObject* LispAtom::New(LispEnvironment& aEnvironment, const std::string& aString)
@@ -39,6 +43,11 @@ const LispString* LispAtom::String()
     return iString;
 }
 
+void LispAtom::FreezeData(int)
+{
+    iString->iReferenceCount.Freeze();
+}
+
 //------------------------------------------------------------------------------
 // LispSublist methods
 
@@ -52,39 +61,107 @@ LispSubList* LispSubList::New(LispObject* aSubList)
     return self;
 }
 
-// A destructor for lists that is less taxing for stacks :-)
-// Eg. deleting a list deletes the entire sublist also, in
-// a tail-recursive way...
+// The elements are released through the work list of LispObject, so
+// that deleting deeply nested lists doesn't exhaust the stack.
 LispSubList::~LispSubList()
 {
-    if (!!iSubList)
+    Dispose(iSubList);
+}
+
+namespace {
+    const unsigned LIST_HASH = 0x2f6b1c3d;
+    const unsigned NUMBER_HASH = 0x61c88647;
+    const unsigned GENERIC_HASH = 0x7f4a7c15;
+
+    inline unsigned CombineHash(unsigned aHash, unsigned aElement)
+    {
+        return aHash ^ (aElement + 0x9e3779b9 + (aHash << 6) + (aHash >> 2));
+    }
+
+    unsigned AtomHash(LispObject* aObject)
     {
-        LispPtr next;
-        LispIterator iter(iSubList);
-        bool busy = (iter.getObj()->iReferenceCount == 1);
-        while (busy) // while there are things to delete...
-        {
-      // TODO: woof -- fix this ugliness!
-            LispPtr nextToDelete;
-            // Make sure "next" holds the tail of the list
-            nextToDelete = (iter.getObj()->Nixed());
-            // Separate out the current element...
-            if (iter.getObj()->iReferenceCount == 1)
-            {// Destructive operation only if necessary...
-                iter.getObj()->Nixed() = (nullptr);
-                // And delete it.
-                (*iter) = (nullptr);
-            }
+        // don't ask a number for its string, it may have to be
+        // converted to decimal
+        if (dynamic_cast<LispNumber*>(aObject))
+            return NUMBER_HASH;
+
+        // strings of atoms are unique
+        if (const LispString* s = aObject->String()) {
+            const std::uintptr_t p = reinterpret_cast<std::uintptr_t>(s);
+            return static_cast<unsigned>(p >> 4) ^ static_cast<unsigned>(p >> 36);
+        }
+
+        return GENERIC_HASH;
+    }
+}
+
+#ifdef YACAS_NO_ATOMIC_TYPES
+std::uint64_t LispSubList::iEpoch = 1;
+#else
+std::atomic<std::uint64_t> LispSubList::iEpoch(1);
+#endif
+
+void LispSubList::Modified()
+{
+    ++iEpoch;
+}
+
+unsigned LispSubList::Hash()
+{
+    const std::uint64_t epoch = iEpoch;
+
+    if (HashValid(epoch))
+        return iHash;
+
+    // the sublists are walked iteratively, the result is cached for
+    // every one of them
+    struct Frame {
+        LispSubList* list;
+        LispObject* next;
+        unsigned hash;
+    };
+
+    std::vector<Frame> todo;
+    todo.push_back(Frame{this, iSubList, LIST_HASH});
+
+    for (;;) {
+        Frame& frame = todo.back();
+
+        if (LispObject* p = frame.next) {
+            frame.next = p->Nixed();
+
+            LispSubList* list = p->SubList() ? dynamic_cast<LispSubList*>(p) : nullptr;
+
+            if (!list)
+                frame.hash = CombineHash(frame.hash, AtomHash(p));
+            else if (list->HashValid(epoch))
+                frame.hash = CombineHash(frame.hash, list->iHash);
             else
-                busy=false;
-            next = (nextToDelete);
-            iter = next;
-            if (!iter.getObj())
-                busy=false;
+                todo.push_back(Frame{list, list->iSubList, LIST_HASH});
+
+            continue;
         }
+
+        const unsigned hash = frame.hash;
+        frame.list->iHash = hash;
+        frame.list->iHashEpoch = epoch;
+
+        todo.pop_back();
+
+        if (todo.empty())
+            return hash;
+
+        todo.back().hash = CombineHash(todo.back().hash, hash);
     }
 }
 
+void LispSubList::FreezeData(int)
+{
+    // frozen lists are shared, so the hash can't be filled in later
+    Hash();
+    iHashEpoch = PERMANENT;
+}
+
 //------------------------------------------------------------------------------
 // LispGenericClass methods
 
@@ -115,14 +192,65 @@ GenericClass* LispGenericClass::Generic()
     return iClass;
 }
 
+void LispGenericClass::FreezeData(int aPrecision)
+{
+    iClass->Freeze(aPrecision);
+}
+
 //------------------------------------------------------------------------------
 // LispNumber methods - proceed at your own risk
 
+namespace {
+    // Parse a plain decimal integer literal, if it fits in a long.
+    bool ParseSmallInteger(const char* aString, long& aValue)
+    {
+        const char* ptr = aString;
+        bool negative = false;
+
+        if (*ptr == '-') {
+            negative = true;
+            ptr++;
+        }
+
+        // bounded so that the value can never overflow a long
+        const std::size_t max_digits = std::numeric_limits<long>::digits10;
+
+        unsigned long value = 0;
+        std::size_t nr_digits = 0;
+        for (; *ptr; ++ptr, ++nr_digits) {
+            if (!std::isdigit(*ptr) || nr_digits == max_digits)
+                return false;
+            value = 10 * value + (*ptr - '0');
+        }
+
+        if (!nr_digits)
+            return false;
+
+        aValue = negative ? -static_cast<long>(value) : static_cast<long>(value);
+
+        return true;
+    }
+}
+
+LispNumber::LispNumber(LispString * aString, int aBasePrecision):
+    iNumber(nullptr), iString(aString), iSmall(0), iIsSmall(false), iIsInt(true)
+{
+    // integer literals are kept small, the BigNumber is created lazily
+    iIsSmall = ParseSmallInteger(aString->c_str(), iSmall);
+
+    if (!iIsSmall)
+        iIsInt = Number(aBasePrecision)->IsInt();
+}
+
 
 /// return a string representation in decimal
 LispString * LispNumber::String()
 {
-  if (!iString)
+  if (!iString && iIsSmall)
+  {
+    iString = new LispString(std::to_string(iSmall));
+  }
+  else if (!iString)
   {
     assert(iNumber.ptr());  // either the string is null or the number but not both
     LispString *str = new LispString;
@@ -139,6 +267,7 @@ BigNumber* LispNumber::Number(int aBasePrecision)
 {
   if (!iNumber)
   {  // create and store a BigNumber out of string
+    String();
     assert(iString.ptr());
     RefPtr<LispString> str;
     str = iString;
@@ -150,7 +279,15 @@ BigNumber* LispNumber::Number(int aBasePrecision)
   // (applies only to floats). Note that iNumber->GetPrecision() might be < 0
   else if (!iNumber->IsInt() && iNumber->GetPrecision() < (int)digits_to_bits(aBasePrecision, BASE10))
   {
-    if (iString)
+    if (iReferenceCount.IsFrozen())
+    {
+  // frozen numbers are shared read-only, keep the precision they were frozen with
+    }
+    else if (iString && iNumber->iReferenceCount.IsFrozen())
+    {// the BigNumber belongs to a frozen number, don't modify it
+      iNumber = new BigNumber(iString->c_str(), aBasePrecision, BASE10);
+    }
+    else if (iString)
     {// have string representation, can extend precision
       iNumber->SetTo(iString->c_str(),aBasePrecision, BASE10);
     }
@@ -162,3 +299,32 @@ BigNumber* LispNumber::Number(int aBasePrecision)
   return iNumber;
 }
 
+
+bool LispNumber::SmallInteger(long& aValue)
+{
+  if (iIsSmall)
+  {
+    aValue = iSmall;
+    return true;
+  }
+
+  if (!iIsInt || !iNumber || !iNumber->ToLong(aValue))
+    return false;
+
+  iSmall = aValue;
+  iIsSmall = true;
+
+  return true;
+}
+
+void LispNumber::FreezeData(int aPrecision)
+{
+  // fill in all the representations, nothing may be cached later on
+  long value;
+  String();
+  Number(aPrecision);
+  SmallInteger(value);
+
+  iString->iReferenceCount.Freeze();
+  iNumber->iReferenceCount.Freeze();
+}
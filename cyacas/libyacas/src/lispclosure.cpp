@@ -0,0 +1,328 @@
+#include "yacas/lispclosure.h"
+
+#include "yacas/errors.h"
+#include "yacas/lispenvironment.h"
+#include "yacas/lispeval.h"
+#include "yacas/lispevalhash.h"
+#include "yacas/mathcommands.h"
+#include "yacas/mathuserfunc.h"
+#include "yacas/standard.h"
+
+#include <typeinfo>
+#include <utility>
+
+namespace {
+    // The checks BasicEvaluator::Eval() does for every expression.
+    class EvalDepth {
+    public:
+        explicit EvalDepth(LispEnvironment& aEnvironment):
+            iEnvironment(aEnvironment)
+        {
+            if (++aEnvironment.iEvalDepth >= aEnvironment.iMaxEvalDepth) {
+                aEnvironment.iEvaluator->ShowStack(aEnvironment, aEnvironment.CurrentOutput());
+                throw LispErrMaxRecurseDepthReached();
+            }
+        }
+
+        ~EvalDepth()
+        {
+            --iEnvironment.iEvalDepth;
+        }
+
+    private:
+        LispEnvironment& iEnvironment;
+    };
+
+    typedef std::vector<std::shared_ptr<const LispClosure>> Closures;
+
+    // evaluate aClosure, in tail position if aCall is not null
+    bool EvaluateIn(const LispClosure& aClosure, LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, LispClosure::TailCall* aCall)
+    {
+        if (aCall)
+            return aClosure.EvaluateTail(aEnvironment, aResult, aTop, *aCall);
+
+        aClosure.Evaluate(aEnvironment, aResult, aTop);
+        return false;
+    }
+
+    // a string, a number or an empty list
+    class Constant final: public LispClosure {
+    public:
+        explicit Constant(LispPtr& aExpression): iExpression(aExpression) {}
+
+        void Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop) const override
+        {
+            EvalDepth depth(aEnvironment);
+            aResult = iExpression->Copy();
+        }
+
+    private:
+        LispPtr iExpression;
+    };
+
+    class Variable final: public LispClosure {
+    public:
+        // aOffset is the distance of the slot from the top, or 0 if the
+        // variable is not a slot
+        Variable(LispPtr& aAtom, std::size_t aOffset): iAtom(aAtom), iOffset(aOffset) {}
+
+        void Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop) const override
+        {
+            EvalDepth depth(aEnvironment);
+
+            if (iOffset && aEnvironment.NrLocals() == aTop) {
+                Result(aEnvironment.LocalValue(aTop - iOffset), aResult);
+                return;
+            }
+
+            LispPtr value;
+            aEnvironment.GetVariable(iAtom->String(), value);
+            Result(value, aResult);
+        }
+
+    private:
+        // the value is shared, as in BasicEvaluator::Eval()
+        void Result(const LispPtr& aValue, LispPtr& aResult) const
+        {
+            if (!aValue)
+                aResult = iAtom->Copy();
+            else if (aValue->Nixed())
+                aResult = aValue->Copy();
+            else
+                aResult = aValue;
+        }
+
+        LispPtr iAtom;
+        std::size_t iOffset;
+    };
+
+    // anything else, left to the interpreter
+    class Interpreted final: public LispClosure {
+    public:
+        explicit Interpreted(LispPtr& aExpression): iExpression(aExpression) {}
+
+        void Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop) const override
+        {
+            aEnvironment.iEvaluator->Eval(aEnvironment, aResult, iExpression);
+        }
+
+    private:
+        mutable LispPtr iExpression;
+    };
+
+    // a list with an atom as its head
+    class Call final: public LispClosure {
+    public:
+        Call(LispPtr& aExpression, Closures& aArguments):
+            iExpression(aExpression),
+            iList(aExpression->SubList()),
+            iName((*iList)->String()),
+            iArguments(std::move(aArguments))
+        {
+        }
+
+        void Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop) const override;
+        bool EvaluateTail(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall& aCall) const override;
+
+    private:
+        bool Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall* aCall) const;
+        bool EvaluateIf(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall* aCall) const;
+        bool EvaluateProg(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall* aCall) const;
+        void EvaluateCore(const YacasEvaluator& aCore, LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop) const;
+        void EvaluateArguments(const BranchingUserFunction& aFunction, LispEnvironment& aEnvironment, std::size_t aTop, std::vector<LispPtr>& aArguments) const;
+
+        mutable LispPtr iExpression;
+        LispPtr* iList;
+        const LispString* iName;
+        Closures iArguments;
+    };
+
+    void Call::Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop) const
+    {
+        Evaluate(aEnvironment, aResult, aTop, nullptr);
+    }
+
+    bool Call::EvaluateTail(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall& aCall) const
+    {
+        return Evaluate(aEnvironment, aResult, aTop, &aCall);
+    }
+
+    bool Call::Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall* aCall) const
+    {
+        EvalDepth depth(aEnvironment);
+        aEnvironment.Safepoint();
+
+        if (const YacasEvaluator* core = aEnvironment.CoreCommand(iName)) {
+            if (core->Caller() == LispIf && (iArguments.size() == 2 || iArguments.size() == 3))
+                return EvaluateIf(aEnvironment, aResult, aTop, aCall);
+
+            if (core->Caller() == LispProgBody)
+                return EvaluateProg(aEnvironment, aResult, aTop, aCall);
+
+            if (core->Flags() == YacasEvaluator::Function && core->NrArgs() == static_cast<int>(iArguments.size()))
+                EvaluateCore(*core, aEnvironment, aResult, aTop);
+            else
+                core->Evaluate(aResult, aEnvironment, *iList);
+            return false;
+        }
+
+        LispUserFunction* userFunc = aEnvironment.UserFunction(iName, iArguments.size());
+
+        if (!userFunc)
+            userFunc = GetUserFunction(aEnvironment, iList);
+
+        if (!userFunc) {
+            ReturnUnEvaluated(aResult, *iList, aEnvironment);
+        } else if (typeid(*userFunc) == typeid(BranchingUserFunction) && !userFunc->Traced()) {
+            const BranchingUserFunction& function = static_cast<const BranchingUserFunction&>(*userFunc);
+
+            // an unfenced function sees the local variables of the
+            // caller, so it has to be called from within the body
+            if (aCall && function.Fenced()) {
+                EvaluateArguments(function, aEnvironment, aTop, aCall->iArguments);
+                aCall->iFunction = &function;
+                aCall->iList = *iList;
+                return true;
+            }
+
+            std::vector<LispPtr> arguments;
+            EvaluateArguments(function, aEnvironment, aTop, arguments);
+            function.EvaluateRules(aResult, aEnvironment, *iList, arguments.data());
+        } else {
+            userFunc->Evaluate(aResult, aEnvironment, *iList);
+        }
+
+        return false;
+    }
+
+    // as LispIf()
+    bool Call::EvaluateIf(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall* aCall) const
+    {
+        LispPtr predicate;
+        iArguments[0]->Evaluate(aEnvironment, predicate, aTop);
+
+        if (IsTrue(aEnvironment, predicate))
+            return EvaluateIn(*iArguments[1], aEnvironment, aResult, aTop, aCall);
+
+        if (!IsFalse(aEnvironment, predicate)) {
+            const int stacktop = aEnvironment.iStack.size();
+            aEnvironment.iStack.push_back(*iList);
+            CheckArg(false, 1, aEnvironment, stacktop);
+        }
+
+        if (iArguments.size() == 3)
+            return EvaluateIn(*iArguments[2], aEnvironment, aResult, aTop, aCall);
+
+        InternalFalse(aEnvironment, aResult);
+        return false;
+    }
+
+    // as LispProgBody()
+    bool Call::EvaluateProg(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall* aCall) const
+    {
+        LispLocalFrame frame(aEnvironment, false);
+
+        InternalTrue(aEnvironment, aResult);
+
+        const std::size_t nrStatements = iArguments.size();
+        for (std::size_t i = 0; i + 1 < nrStatements; ++i)
+            iArguments[i]->Evaluate(aEnvironment, aResult, aTop);
+
+        if (nrStatements == 0)
+            return false;
+
+        return EvaluateIn(*iArguments.back(), aEnvironment, aResult, aTop, aCall);
+    }
+
+    // as YacasEvaluator::Evaluate() for a function with a fixed number
+    // of arguments
+    void Call::EvaluateCore(const YacasEvaluator& aCore, LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop) const
+    {
+        const int stacktop = aEnvironment.iStack.size();
+        const std::size_t nrArgs = iArguments.size();
+
+        aEnvironment.iStack.push_back(*iList);
+        aEnvironment.iStack.resize(stacktop + 1 + nrArgs);
+
+        for (std::size_t i = 0; i < nrArgs; ++i)
+            iArguments[i]->Evaluate(aEnvironment, aEnvironment.iStack[stacktop + 1 + i], aTop);
+
+        aCore.Caller()(aEnvironment, stacktop);
+        aResult = std::move(aEnvironment.iStack[stacktop]);
+        aEnvironment.iStack.resize(stacktop);
+    }
+
+    // as the first half of BranchingUserFunction::Evaluate()
+    void Call::EvaluateArguments(const BranchingUserFunction& aFunction, LispEnvironment& aEnvironment, std::size_t aTop, std::vector<LispPtr>& aArguments) const
+    {
+        const std::size_t arity = iArguments.size();
+
+        aArguments.resize(arity);
+
+        LispIterator iter(*iList);
+        ++iter;
+
+        for (std::size_t i = 0; i < arity; ++i, ++iter) {
+            if (aFunction.Held(i))
+                aArguments[i] = iter.getObj()->Copy();
+            else
+                iArguments[i]->Evaluate(aEnvironment, aArguments[i], aTop);
+        }
+    }
+
+    std::shared_ptr<const LispClosure> CompileExpression(LispPtr& aExpression, const std::vector<const LispString*>& aSlots)
+    {
+        if (const LispString* str = aExpression->String()) {
+            if (str->front() == '\"' || IsNumber(str->c_str(), true))
+                return std::make_shared<Constant>(aExpression);
+
+            // the last one declared hides the others
+            const std::size_t nrSlots = aSlots.size();
+            for (std::size_t i = nrSlots; i > 0; --i)
+                if (aSlots[i - 1] == str)
+                    return std::make_shared<Variable>(aExpression, nrSlots - i + 1);
+
+            return std::make_shared<Variable>(aExpression, 0);
+        }
+
+        LispPtr* subList = aExpression->SubList();
+
+        if (!subList || !*subList)
+            return std::make_shared<Constant>(aExpression);
+
+        if (!(*subList)->String())
+            return std::make_shared<Interpreted>(aExpression);
+
+        Closures arguments;
+        for (LispIterator iter((*subList)->Nixed()); iter.getObj(); ++iter)
+            arguments.push_back(CompileExpression(*iter, aSlots));
+
+        return std::make_shared<Call>(aExpression, arguments);
+    }
+}
+
+std::shared_ptr<const LispClosure> LispClosure::Compile(LispPtr& aExpression, const std::vector<const LispString*>& aSlots)
+{
+    return CompileExpression(aExpression, aSlots);
+}
+
+bool LispClosure::Enabled(LispEnvironment& aEnvironment)
+{
+    return aEnvironment.RuleCompilation() && typeid(*aEnvironment.iEvaluator) == typeid(BasicEvaluator);
+}
+
+void LispClosure::Evaluate(LispEnvironment& aEnvironment, LispPtr& aResult) const
+{
+    Evaluate(aEnvironment, aResult, aEnvironment.NrLocals());
+}
+
+bool LispClosure::EvaluateTail(LispEnvironment& aEnvironment, LispPtr& aResult, TailCall& aCall) const
+{
+    return EvaluateTail(aEnvironment, aResult, aEnvironment.NrLocals(), aCall);
+}
+
+bool LispClosure::EvaluateTail(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aTop, TailCall& aCall) const
+{
+    Evaluate(aEnvironment, aResult, aTop);
+    return false;
+}
@@ -6,10 +6,20 @@
 #include "yacas/lispuserfunc.h"
 #include "yacas/mathuserfunc.h"
 #include "yacas/errors.h"
+#include "yacas/deffile.h"
+#include "yacas/lisparena.h"
 
 // we need this only for digits_to_bits
 #include "yacas/numbers.h"
 
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+    // the number of safepoints passed between two checks
+    const int SAFEPOINT_INTERVAL = 1024;
+}
+
 LispEnvironment::LispEnvironment(
                     YacasCoreCommands& aCoreCommands,
                     LispUserFunctions& aUserFunctions,
@@ -30,8 +40,10 @@ LispEnvironment::LispEnvironment(
     //iCleanup(),
     iEvalDepth(0),
     iMaxEvalDepth(1000),
-    stop_evaluation(false),
     iEvaluator(new BasicEvaluator),
+    iSafepointCountdown(SAFEPOINT_INTERVAL),
+    iInterrupted(false),
+    iHasDeadline(false),
     iInputStatus(),
     secure(false),
     iTrue(),
@@ -50,6 +62,7 @@ LispEnvironment::LispEnvironment(
     iProg(),
     iLastUniqueId(1),
     iDebugger(nullptr),
+    _fence(0),
     iInitialOutput(&aOutput),
     iCoreCommands(aCoreCommands),
     iUserFunctions(aUserFunctions),
@@ -64,6 +77,9 @@ LispEnvironment::LispEnvironment(
     iBodiedOperators(aBodiedOperators),
     protected_symbols(protected_symbols),
     iCurrentInput(aCurrentInput),
+    iHashCons(nullptr),
+    iRuleCompilation(true),
+    iDispatchGeneration(1),
     iPrettyReader(nullptr),
     iPrettyPrinter(nullptr),
     iDefaultTokenizer(),
@@ -103,6 +119,7 @@ LispEnvironment::~LispEnvironment()
 {
     delete iEvaluator;
     delete iDebugger;
+    delete iHashCons;
 }
 
 void LispEnvironment::SetPrecision(int aPrecision)
@@ -111,16 +128,253 @@ void LispEnvironment::SetPrecision(int aPrecision)
   iBinaryPrecision = digits_to_bits(aPrecision, BASE10);  // in bits
 }
 
+void LispEnvironment::Interrupt()
+{
+    iInterrupted = true;
+}
+
+void LispEnvironment::ClearInterrupt()
+{
+    iInterrupted = false;
+}
+
+void LispEnvironment::SetDeadline(std::chrono::steady_clock::time_point aDeadline)
+{
+    iDeadline = aDeadline;
+    iHasDeadline = true;
+}
+
+void LispEnvironment::ClearDeadline()
+{
+    iHasDeadline = false;
+}
+
+void LispEnvironment::CheckSafepoint()
+{
+    iSafepointCountdown = SAFEPOINT_INTERVAL;
+
+    LispArena* arena = LispArena::Current();
+    if (arena && arena->TakeLimitSignal())
+        throw LispErrMaxMemoryReached();
+
+    if (iInterrupted) {
+        iInterrupted = false;
+        iEvaluator->ShowStack(*this, CurrentOutput());
+        throw LispErrUserInterrupt();
+    }
+
+    // the deadline stays until the evaluation is over
+    if (iHasDeadline && std::chrono::steady_clock::now() >= iDeadline) {
+        iEvaluator->ShowStack(*this, CurrentOutput());
+        throw LispErrTimeout();
+    }
+}
+
+void LispEnvironment::Freeze()
+{
+    for (auto& p: iUserFunctions)
+        p.second.Freeze(iPrecision);
+
+    for (auto& p: iGlobals)
+        if (!!p.second.iValue)
+            p.second.iValue->Freeze(iPrecision);
+
+    iHashTable.Freeze();
+}
+
+void LispEnvironment::Attach(const LispEnvironment& aFrozen)
+{
+    InvalidateDispatch();
+
+    iCoreCommands = aFrozen.iCoreCommands;
+    iDefFiles = aFrozen.iDefFiles;
+
+    for (const auto& p: aFrozen.iUserFunctions) {
+        LispMultiUserFunction& f = iUserFunctions.insert(p).first->second;
+        if (f.iFileToOpen)
+            f.iFileToOpen = iDefFiles.File(f.iFileToOpen->FileName());
+    }
+
+    for (const auto& p: aFrozen.iGlobals) {
+        // the copy constructor of LispGlobalVariable drops the flag
+        LispGlobalVariable& v = iGlobals.insert(p).first->second;
+        v.iEvalBeforeReturn = p.second.iEvalBeforeReturn;
+    }
+
+    iPreFixOperators = aFrozen.iPreFixOperators;
+    iInFixOperators = aFrozen.iInFixOperators;
+    iPostFixOperators = aFrozen.iPostFixOperators;
+    iBodiedOperators = aFrozen.iBodiedOperators;
+
+    protected_symbols.insert(aFrozen.protected_symbols.begin(), aFrozen.protected_symbols.end());
+
+    iAssociative = aFrozen.iAssociative;
+    iCommutative = aFrozen.iCommutative;
+
+    SetPrecision(aFrozen.iPrecision);
+    iInputDirectories = aFrozen.iInputDirectories;
+    iPrettyReader = aFrozen.iPrettyReader;
+    iPrettyPrinter = aFrozen.iPrettyPrinter;
+    iLastUniqueId = aFrozen.iLastUniqueId;
+    iRuleCompilation = aFrozen.iRuleCompilation;
+
+    // the canonical lists are frozen, so they can be shared as well
+    if (aFrozen.iHashCons) {
+        delete iHashCons;
+        iHashCons = new LispHashCons(*aFrozen.iHashCons);
+    }
+}
+
+namespace {
+    // The elements of a list, which are shared by the copies of the
+    // list object, if they are frozen, and nullptr otherwise.
+    LispObject* FrozenElements(const LispPtr& aObject)
+    {
+        if (!aObject || !aObject->SubList())
+            return nullptr;
+
+        LispObject* elements = *aObject->SubList();
+
+        return elements && elements->iReferenceCount.IsFrozen() ? elements : nullptr;
+    }
+
+    // Whether the frozen list aRoot contains a list with the elements
+    // aElements. The lists are walked iteratively, they can be deeply
+    // nested.
+    bool ContainsFrozen(LispObject* aRoot, LispObject* aElements)
+    {
+        std::vector<LispObject*> todo(1, *aRoot->SubList());
+        std::unordered_set<LispObject*> seen;
+
+        while (!todo.empty()) {
+            LispObject* p = todo.back();
+            todo.pop_back();
+
+            for (; p; p = p->Nixed()) {
+                LispObject* elements = p->SubList() ? p->SubList()->ptr() : nullptr;
+                if (!elements)
+                    continue;
+                if (elements == aElements)
+                    return true;
+                if (seen.insert(elements).second)
+                    todo.push_back(elements);
+            }
+        }
+
+        return false;
+    }
+
+    // Map the elements of every list in aOriginal to their counterpart
+    // in aCopy, a deep copy of it.
+    void MapCopy(LispObject* aOriginal, LispObject* aCopy,
+                 std::unordered_map<LispObject*, LispObject*>& aMap)
+    {
+        std::vector<std::pair<LispObject*, LispObject*>> todo(1, {*aOriginal->SubList(), *aCopy->SubList()});
+
+        while (!todo.empty()) {
+            const std::pair<LispObject*, LispObject*> p = todo.back();
+            todo.pop_back();
+
+            aMap[p.first] = p.second;
+
+            LispObject* q = p.second;
+            for (LispObject* o = p.first; o; o = o->Nixed(), q = q->Nixed())
+                if (o->SubList() && *o->SubList())
+                    todo.emplace_back(*o->SubList(), *q->SubList());
+        }
+    }
+}
+
+bool LispEnvironment::Thaw(LispPtr& aList)
+{
+    LispObject* elements = FrozenElements(aList);
+
+    if (!elements)
+        return false;
+
+    std::vector<LispPtr*> values;
+    for (LispLocalVariable& v: _local_vars)
+        if (FrozenElements(v.val))
+            values.push_back(&v.val);
+    for (auto& p: iGlobals)
+        if (FrozenElements(p.second.iValue))
+            values.push_back(&p.second.iValue);
+
+    // the outermost list held by a variable which contains aList
+    LispPtr* root = nullptr;
+    for (bool found = true; found;) {
+        found = false;
+        for (LispPtr* v: values) {
+            if (FrozenElements(*v) == elements) {
+                if (!root)
+                    root = v;
+            } else if (ContainsFrozen(*v, elements)) {
+                root = v;
+                elements = FrozenElements(*v);
+                found = true;
+                break;
+            }
+        }
+    }
+
+    if (!root)
+        return false;
+
+    LispPtr original(*root);
+    LispPtr copied;
+    InternalDeepCopy(copied, original);
+
+    std::unordered_map<LispObject*, LispObject*> counterparts;
+    MapCopy(original, copied, counterparts);
+
+    // the variables holding the list, or a list in it, hold the copy
+    for (LispPtr* v: values) {
+        const auto i = counterparts.find(FrozenElements(*v));
+        if (i != counterparts.end())
+            *v = LispSubList::New(i->second);
+    }
+
+    aList = LispSubList::New(counterparts[FrozenElements(aList)]);
+
+    return true;
+}
+
+void LispEnvironment::SetHashConsing(bool aEnabled)
+{
+    if (aEnabled && !iHashCons)
+        iHashCons = new LispHashCons(iList->String());
+
+    if (!aEnabled) {
+        delete iHashCons;
+        iHashCons = nullptr;
+    }
+}
+
 int LispEnvironment::GetUniqueId()
 {
     return iLastUniqueId++;
 }
 
 
+const std::size_t LispEnvironment::unbound;
+
 LispPtr* LispEnvironment::FindLocal(const LispString* aVariable)
 {
     assert(!_local_frames.empty());
 
+    if (const unsigned id = aVariable->iId) {
+        if (id >= _bindings.size())
+            return nullptr;
+
+        const std::size_t i = _bindings[id];
+
+        if (i == unbound || i < _fence)
+            return nullptr;
+
+        return &_local_vars[i].val;
+    }
+
+    // not in the hash table, so not deep bound either
     std::size_t last = _local_vars.size();
 
     for (std::vector<LocalVariableFrame>::const_reverse_iterator f = _local_frames.rbegin(); f != _local_frames.rend(); ++f) {
@@ -198,22 +452,52 @@ void LispEnvironment::UnsetVariable(const LispString* var)
 
 void LispEnvironment::PushLocalFrame(bool fenced)
 {
-    _local_frames.emplace_back(_local_vars.size(), fenced);
+    _local_frames.emplace_back(_local_vars.size(), fenced, _fence);
+
+    if (fenced)
+        _fence = _local_vars.size();
 }
 
 void LispEnvironment::PopLocalFrame()
 {
     assert(!_local_frames.empty());
 
-    _local_vars.erase(_local_vars.begin() + _local_frames.back().first, _local_vars.end());
+    const LocalVariableFrame& frame = _local_frames.back();
+
+    PopLocals(frame.first);
+
+    _fence = frame.fence;
     _local_frames.pop_back();
 }
 
+void LispEnvironment::PopLocals(std::size_t aSize)
+{
+    assert(!_local_frames.empty() && aSize >= _local_frames.back().first);
+
+    while (_local_vars.size() > aSize) {
+        const LispLocalVariable& v = _local_vars.back();
+        if (const unsigned id = v.var->iId)
+            _bindings[id] = v.shadowed;
+        _local_vars.pop_back();
+    }
+}
+
 void LispEnvironment::NewLocal(const LispString* var, LispObject* val)
 {
     assert(!_local_frames.empty());
 
-    _local_vars.emplace_back(var, val);
+    const unsigned id = var->iId;
+
+    if (!id) {
+        _local_vars.emplace_back(var, val, unbound);
+        return;
+    }
+
+    if (id >= _bindings.size())
+        _bindings.resize(std::max<std::size_t>(id + 1, iHashTable.IdLimit()), unbound);
+
+    _local_vars.emplace_back(var, val, _bindings[id]);
+    _bindings[id] = _local_vars.size() - 1;
 }
 
 void LispEnvironment::CurrentLocals(LispPtr& aResult)
@@ -291,23 +575,33 @@ void LispEnvironment::SetCurrentOutput(std::ostream& aOutput)
 
 LispUserFunction* LispEnvironment::UserFunction(LispPtr& aArguments)
 {
-    auto i = iUserFunctions.find(aArguments->String());
-    if (i != iUserFunctions.end()) {
-        LispMultiUserFunction* multiUserFunc = &i->second;
-        int arity = InternalListLength(aArguments)-1;
-        return  multiUserFunc->UserFunc(arity);
-    }
-    return nullptr;
-}
+    const LispString* name = aArguments->String();
+
+    if (!Dispatch(name).iMultiUserFunction)
+        return nullptr;
 
+    return UserFunction(name, InternalListLength(aArguments) - 1);
+}
 
-LispUserFunction* LispEnvironment::UserFunction(const LispString* aName, int aArity)
+void LispEnvironment::FillDispatch(DispatchEntry& aEntry, const LispString* aName)
 {
-    auto i = iUserFunctions.find(aName);
-    if (i != iUserFunctions.end())
-        return i->second.UserFunc(aArity);
+    const auto c = iCoreCommands.find(aName);
+    const auto u = iUserFunctions.find(aName);
 
-    return nullptr;
+    aEntry.iGeneration = iDispatchGeneration;
+    aEntry.iArity = -1;
+    aEntry.iName = aName;
+    aEntry.iCoreCommand = c != iCoreCommands.end() ? &c->second : nullptr;
+    aEntry.iMultiUserFunction = u != iUserFunctions.end() ? &u->second : nullptr;
+    aEntry.iUserFunction = nullptr;
+}
+
+void LispEnvironment::InvalidateDispatch()
+{
+    if (++iDispatchGeneration == 0) {
+        iDispatch.clear();
+        iDispatchGeneration = 1;
+    }
 }
 
 
@@ -339,8 +633,32 @@ void LispEnvironment::Retract(const LispString* aOperator, int aArity)
 
     auto i = iUserFunctions.find(aOperator);
 
-    if (i != iUserFunctions.end())
+    if (i != iUserFunctions.end()) {
         i->second.DeleteBase(aArity);
+        InvalidateDispatch();
+    }
+}
+
+BranchingUserFunction* LispEnvironment::MemoizableRule(const LispString* aOperator, int aArity)
+{
+    auto i = iUserFunctions.find(aOperator);
+
+    if (i == iUserFunctions.end())
+        throw LispErrInvalidArg();
+
+    LispMultiUserFunction* multiUserFunc = &i->second;
+
+    if (LispDefFile* def = multiUserFunc->iFileToOpen) {
+        multiUserFunc->iFileToOpen = nullptr;
+        InternalUse(*this, def->FileName());
+    }
+
+    LispUserFunction* userFunc = multiUserFunc->UserFunc(aArity);
+
+    if (!userFunc || dynamic_cast<MacroUserFunction*>(userFunc))
+        throw LispErrInvalidArg();
+
+    return static_cast<BranchingUserFunction*>(userFunc);
 }
 
 void LispEnvironment::DeclareRuleBase(const LispString* aOperator,
@@ -366,6 +684,7 @@ void LispEnvironment::DeclareRuleBase(const LispString* aOperator,
             : new BranchingUserFunction(aParameters);
 
     multiUserFunc->DefineRuleBase(newFunc);
+    InvalidateDispatch();
 }
 
 void LispEnvironment::DeclareMacroRuleBase(const LispString* aOperator, LispPtr& aParameters, int aListed)
@@ -381,6 +700,7 @@ void LispEnvironment::DeclareMacroRuleBase(const LispString* aOperator, LispPtr&
             : new MacroUserFunction(aParameters);
 
     multiUserFunc->DefineRuleBase(newFunc);
+    InvalidateDispatch();
 }
 
 
@@ -393,6 +713,8 @@ LispMultiUserFunction* LispEnvironment::MultiUserFunction(const LispString* aOpe
     if (i != iUserFunctions.end())
         return &i->second;
 
+    InvalidateDispatch();
+
     LispMultiUserFunction newMulti;
     return &iUserFunctions.insert(std::make_pair(aOperator, newMulti)).first->second;
     //SetAssociation(newMulti, aOperator);
@@ -426,6 +748,32 @@ bool LispEnvironment::Protected(const LispString* symbol) const
     return protected_symbols.find(symbol) != protected_symbols.end();
 }
 
+void LispEnvironment::SetAssociative(const LispString* aFunction, bool aAssociative)
+{
+    if (aAssociative)
+        iAssociative.insert(aFunction);
+    else
+        iAssociative.erase(aFunction);
+}
+
+void LispEnvironment::SetCommutative(const LispString* aFunction, bool aCommutative)
+{
+    if (aCommutative)
+        iCommutative.insert(aFunction);
+    else
+        iCommutative.erase(aFunction);
+}
+
+bool LispEnvironment::IsAssociative(const LispString* aFunction) const
+{
+    return iAssociative.find(aFunction) != iAssociative.end();
+}
+
+bool LispEnvironment::IsCommutative(const LispString* aFunction) const
+{
+    return iCommutative.find(aFunction) != iCommutative.end();
+}
+
 void LispEnvironment::DefineRule(const LispString* aOperator,int aArity,
                                  int aPrecedence, LispPtr& aPredicate,
                                  LispPtr& aBody)
@@ -457,6 +805,8 @@ void LispEnvironment::DefineRule(const LispString* aOperator,int aArity,
     }
     else
         userFunc->DeclareRule(aPrecedence, aPredicate,aBody);
+
+    multiUserFunc->Forget();
 }
 
 void LispEnvironment::DefineRulePattern(const LispString* aOperator,int aArity,
@@ -482,10 +832,14 @@ void LispEnvironment::DefineRulePattern(const LispString* aOperator,int aArity,
 
     // Declare a new evaluation rule
     userFunc->DeclarePattern(aPrecedence, aPredicate,aBody);
+
+    multiUserFunc->Forget();
 }
 
 void LispEnvironment::SetCommand(YacasEvalCaller aEvaluatorFunc, const char* aString,int aNrArgs,int aFlags)
 {
+  InvalidateDispatch();
+
   const LispString* name = HashTable().LookUp(aString);
   YacasEvaluator eval(aEvaluatorFunc,aNrArgs,aFlags);
   auto i = iCoreCommands.find(name);
@@ -497,6 +851,8 @@ void LispEnvironment::SetCommand(YacasEvalCaller aEvaluatorFunc, const char* aSt
 
 void LispEnvironment::RemoveCoreCommand(char* aString)
 {
+  InvalidateDispatch();
+
   iCoreCommands.erase(HashTable().LookUp(aString));
 }
 
@@ -54,12 +54,6 @@ void BasicEvaluator::Eval(LispEnvironment& aEnvironment, LispPtr& aResult, LispP
 {
   assert(aExpression);
 
-  if (aEnvironment.stop_evaluation) {
-      aEnvironment.stop_evaluation = false;
-      ShowStack(aEnvironment, aEnvironment.CurrentOutput());
-      throw LispErrUserInterrupt();
-  }
-
   aEnvironment.iEvalDepth++;
   if (aEnvironment.iEvalDepth >= aEnvironment.iMaxEvalDepth) {
       ShowStack(aEnvironment, aEnvironment.CurrentOutput());
@@ -81,7 +75,11 @@ void BasicEvaluator::Eval(LispEnvironment& aEnvironment, LispPtr& aResult, LispP
     aEnvironment.GetVariable(str,val);
     if (!!val)
     {
-      aResult = (val->Copy());
+      // shared, whoever links the result into a list detaches it
+      if (val->Nixed())
+        aResult = (val->Copy());
+      else
+        aResult = (val);
       goto FINISH;
     }
     aResult = (aExpression->Copy());
@@ -96,14 +94,13 @@ void BasicEvaluator::Eval(LispEnvironment& aEnvironment, LispPtr& aResult, LispP
       LispObject* head = (*subList);
       if (head)
       {
+        aEnvironment.Safepoint();
+
         if (head->String())
         {
-          {
-              const auto i = aEnvironment.CoreCommands().find(head->String());
-              if (i != aEnvironment.CoreCommands().end()) {
-                  i->second.Evaluate(aResult, aEnvironment, *subList);
-                  goto FINISH;
-              }
+          if (const YacasEvaluator* core = aEnvironment.CoreCommand(head->String())) {
+              core->Evaluate(aResult, aEnvironment, *subList);
+              goto FINISH;
           }
 
           {
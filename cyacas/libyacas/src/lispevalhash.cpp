@@ -6,6 +6,8 @@
 #include "yacas/lispeval.h"
 #include "yacas/errors.h"
 
+#include <utility>
+
 
 
 void YacasEvaluator::Evaluate(LispPtr& aResult,LispEnvironment& aEnvironment,LispPtr& aArguments) const
@@ -49,18 +51,20 @@ void YacasEvaluator::Evaluate(LispPtr& aResult,LispEnvironment& aEnvironment,Lis
   }
   else
   {
-    LispPtr arg;
+    // Evaluate the arguments straight into their slots, which stay put
+    // while the evaluation pushes and pops above them
+    aEnvironment.iStack.resize(stacktop + 1 + nr);
     for (i=0;i<nr;i++)
     {
       if (!iter.getObj())
           throw LispErrWrongNumberOfArgs();
 
-      aEnvironment.iEvaluator->Eval(aEnvironment, arg, *iter);
-      aEnvironment.iStack.push_back(arg);
+      aEnvironment.iEvaluator->Eval(aEnvironment, aEnvironment.iStack[stacktop + 1 + i], *iter);
       ++iter;
     }
     if (iFlags & Variable)
     {
+      LispPtr arg;
 
 //LispString res;
 
@@ -82,13 +86,13 @@ PrintExpression(res, arg,aEnvironment,100);
 printf("after %s\n",res.String());
 */
 
-      aEnvironment.iStack.push_back(arg);
+      aEnvironment.iStack.push_back(std::move(arg));
 //printf("Leave\n");
     }
   }
 
   iCaller(aEnvironment,stacktop);
-  aResult = (aEnvironment.iStack[stacktop]);
+  aResult = std::move(aEnvironment.iStack[stacktop]);
   aEnvironment.iStack.resize(stacktop);
 }
 
@@ -7,7 +7,14 @@ const LispString* LispHashTable::LookUp(const std::string& s)
         return i->second;
 
     LispString* ls = new LispString(s);
-    ls->iReferenceCount = 1;
+    ++ls->iReferenceCount;
+
+    if (_free_ids.empty()) {
+        ls->iId = _id_limit++;
+    } else {
+        ls->iId = _free_ids.back();
+        _free_ids.pop_back();
+    }
 
     return _rep.insert(std::make_pair(s, ls)).first->second;
 }
@@ -15,6 +22,14 @@ const LispString* LispHashTable::LookUp(const std::string& s)
 void LispHashTable::GarbageCollect()
 {
     for (auto i = _rep.begin(); i != _rep.end(); ++i)
-        while (i != _rep.end() && i->second->iReferenceCount == 1)
+        while (i != _rep.end() && i->second->iReferenceCount == 1) {
+            _free_ids.push_back(i->second->iId);
             i = _rep.erase(i);
+        }
+}
+
+void LispHashTable::Freeze()
+{
+    for (auto& p: _rep)
+        p.second->iReferenceCount.Freeze();
 }
@@ -0,0 +1,101 @@
+
+#include "yacas/lisphashcons.h"
+
+#include <functional>
+#include <string>
+#include <typeinfo>
+
+namespace {
+    const std::size_t LIST_SEED = 0x9e3779b9;
+
+    inline std::size_t Combine(std::size_t aHash, std::size_t aElement)
+    {
+        return aHash * 31 + aElement;
+    }
+}
+
+void LispHashCons::Intern(LispPtr& aExpression, int aPrecision)
+{
+    std::size_t hash;
+
+    if (!!aExpression)
+        Intern(aExpression.ptr(), aPrecision, hash);
+}
+
+bool LispHashCons::Intern(LispObject* aObject, int aPrecision, std::size_t& aHash)
+{
+    if (aObject->iReferenceCount.IsFrozen() || aObject->Generic())
+        return false;
+
+    LispPtr* subList = aObject->SubList();
+
+    if (!subList) {
+        const LispString* s = aObject->String();
+        if (!s)
+            return false;
+        aHash = std::hash<std::string>()(*s);
+        return true;
+    }
+
+    if (!!*subList && (*subList)->iReferenceCount.IsFrozen())
+        return false;
+
+    // the elements are interned even if this list can't be shared
+    bool shareable = true;
+    std::size_t hash = LIST_SEED;
+
+    for (LispObject* p = *subList; p; p = p->Nixed()) {
+        std::size_t h = 0;
+        if (!Intern(p, aPrecision, h))
+            shareable = false;
+        hash = Combine(hash, h);
+    }
+
+    if (!shareable || (!!*subList && (*subList)->String() == iList))
+        return false;
+
+    aHash = hash;
+
+    if (!*subList)
+        return true;
+
+    const auto range = iChains.equal_range(hash);
+    for (auto i = range.first; i != range.second; ++i) {
+        LispObject* p1 = i->second;
+        LispObject* p2 = *subList;
+
+        while (p1 && p2 && Identical(p1, p2)) {
+            p1 = p1->Nixed();
+            p2 = p2->Nixed();
+        }
+
+        if (!p1 && !p2) {
+            *subList = i->second;
+            return true;
+        }
+    }
+
+    (*subList)->Freeze(aPrecision);
+    iChains.insert(std::make_pair(hash, subList->ptr()));
+
+    return true;
+}
+
+bool LispHashCons::Identical(LispObject* a1, LispObject* a2)
+{
+    if (a1 == a2)
+        return true;
+
+    if (typeid(*a1) != typeid(*a2))
+        return false;
+
+    // the elements of interned lists are interned already
+    if (LispPtr* subList = a1->SubList())
+        return subList->ptr() == a2->SubList()->ptr();
+
+    // atoms share the string, numbers are compared by their text
+    const LispString* s1 = a1->String();
+    const LispString* s2 = a2->String();
+
+    return s1 == s2 || (s1 && s2 && *s1 == *s2);
+}
@@ -0,0 +1,228 @@
+#include "yacas/lispmemo.h"
+
+#include "yacas/lispatom.h"
+
+#include <functional>
+#include <iterator>
+#include <string>
+#include <utility>
+
+namespace {
+    const unsigned LIST_BEGIN = 0x2f6b1c3d;
+    const unsigned LIST_END = 0x5bd1e995;
+    const unsigned GENERIC_HASH = 0x7f4a7c15;
+
+    inline unsigned CombineHash(unsigned aHash, unsigned aElement)
+    {
+        return aHash ^ (aElement + 0x9e3779b9 + (aHash << 6) + (aHash >> 2));
+    }
+
+    // Unlike LispSubList::Hash(), numbers contribute their digits, as
+    // they are compared by them.
+    unsigned ElementHash(LispObject* aObject)
+    {
+        if (dynamic_cast<LispNumber*>(aObject))
+            return static_cast<unsigned>(std::hash<std::string>()(*aObject->String()));
+
+        if (const LispString* s = aObject->String()) {
+            const std::uintptr_t p = reinterpret_cast<std::uintptr_t>(s);
+            return static_cast<unsigned>(p >> 4) ^ static_cast<unsigned>(p >> 36);
+        }
+
+        if (aObject->SubList())
+            return LIST_BEGIN;
+
+        return GENERIC_HASH;
+    }
+
+    bool SameElement(LispObject* aFirst, LispObject* aSecond)
+    {
+        LispNumber* n1 = dynamic_cast<LispNumber*>(aFirst);
+        LispNumber* n2 = dynamic_cast<LispNumber*>(aSecond);
+
+        if (n1 || n2)
+            return n1 && n2 && *n1->String() == *n2->String();
+
+        if (aFirst->String() || aSecond->String())
+            return aFirst->String() == aSecond->String();
+
+        if (!aFirst->SubList() || !aSecond->SubList())
+            return !aFirst->SubList() && !aSecond->SubList() && aFirst->Generic() == aSecond->Generic();
+
+        return true;
+    }
+
+    // The sublists are walked iteratively, arguments can be deeply
+    // nested.
+    unsigned Hash(LispObject* aObject, unsigned aHash)
+    {
+        aHash = CombineHash(aHash, ElementHash(aObject));
+
+        if (!aObject->SubList())
+            return aHash;
+
+        // the rest of every list being walked
+        std::vector<LispObject*> todo(1, *aObject->SubList());
+
+        while (!todo.empty()) {
+            LispObject* p = todo.back();
+
+            if (!p) {
+                todo.pop_back();
+                aHash = CombineHash(aHash, LIST_END);
+                continue;
+            }
+
+            todo.back() = p->Nixed();
+            aHash = CombineHash(aHash, ElementHash(p));
+
+            if (p->SubList())
+                todo.push_back(*p->SubList());
+        }
+
+        return aHash;
+    }
+
+    bool Same(LispObject* aFirst, LispObject* aSecond)
+    {
+        if (aFirst == aSecond)
+            return true;
+
+        if (!SameElement(aFirst, aSecond))
+            return false;
+
+        if (!aFirst->SubList())
+            return true;
+
+        std::vector<std::pair<LispObject*, LispObject*>> todo;
+        todo.emplace_back(*aFirst->SubList(), *aSecond->SubList());
+
+        while (!todo.empty()) {
+            LispObject* p = todo.back().first;
+            LispObject* q = todo.back().second;
+
+            if (p == q) {
+                todo.pop_back();
+                continue;
+            }
+
+            if (!p || !q || !SameElement(p, q))
+                return false;
+
+            todo.back() = std::make_pair(p->Nixed(), q->Nixed());
+
+            if (p->SubList())
+                todo.emplace_back(*p->SubList(), *q->SubList());
+        }
+
+        return true;
+    }
+}
+
+LispMemoTable::LispMemoTable(std::size_t aLimit):
+    iLimit(aLimit),
+    iGeneration(0),
+    iHits(0),
+    iMisses(0)
+{
+}
+
+LispMemoTable::Key LispMemoTable::MakeKey(const LispPtr* aArguments, std::size_t aArity, int aPrecision) const
+{
+    Key key;
+    key.iArguments.assign(aArguments, aArguments + aArity);
+    key.iPrecision = aPrecision;
+    key.iHash = CombineHash(LIST_BEGIN, static_cast<unsigned>(aPrecision));
+    for (const LispPtr& p: key.iArguments)
+        key.iHash = Hash(p, key.iHash);
+    key.iGeneration = iGeneration;
+    return key;
+}
+
+LispMemoTable::Entries::iterator LispMemoTable::Lookup(const Key& aKey)
+{
+    const auto range = iIndex.equal_range(aKey.iHash);
+
+    for (auto i = range.first; i != range.second; ++i) {
+        const Key& key = i->second->iKey;
+
+        if (key.iPrecision != aKey.iPrecision || key.iArguments.size() != aKey.iArguments.size())
+            continue;
+
+        std::size_t j = 0;
+        while (j < key.iArguments.size() && Same(key.iArguments[j], aKey.iArguments[j]))
+            ++j;
+
+        if (j == key.iArguments.size())
+            return i->second;
+    }
+
+    return iEntries.end();
+}
+
+bool LispMemoTable::Find(const Key& aKey, LispPtr& aResult)
+{
+    const Entries::iterator i = Lookup(aKey);
+
+    if (i == iEntries.end()) {
+        ++iMisses;
+        return false;
+    }
+
+    ++iHits;
+    iEntries.splice(iEntries.begin(), iEntries, i);
+    aResult = i->iResult;
+    return true;
+}
+
+void LispMemoTable::Insert(Key&& aKey, const LispPtr& aResult)
+{
+    if (aKey.iGeneration != iGeneration || iLimit == 0)
+        return;
+
+    // a recursive call may have remembered it already
+    const Entries::iterator i = Lookup(aKey);
+
+    if (i != iEntries.end()) {
+        i->iResult = aResult;
+        iEntries.splice(iEntries.begin(), iEntries, i);
+        return;
+    }
+
+    const unsigned hash = aKey.iHash;
+    iEntries.push_front(Entry{std::move(aKey), aResult});
+    iIndex.emplace(hash, iEntries.begin());
+
+    while (iEntries.size() > iLimit)
+        Evict();
+}
+
+void LispMemoTable::Evict()
+{
+    const Entries::iterator last = std::prev(iEntries.end());
+    const auto range = iIndex.equal_range(last->iKey.iHash);
+
+    for (auto i = range.first; i != range.second; ++i) {
+        if (i->second == last) {
+            iIndex.erase(i);
+            break;
+        }
+    }
+
+    iEntries.erase(last);
+}
+
+void LispMemoTable::Clear()
+{
+    iIndex.clear();
+    iEntries.clear();
+    ++iGeneration;
+}
+
+void LispMemoTable::SetLimit(std::size_t aLimit)
+{
+    iLimit = aLimit;
+
+    while (iEntries.size() > iLimit)
+        Evict();
+}
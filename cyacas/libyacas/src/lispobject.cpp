@@ -1,6 +1,84 @@
 
 #include "yacas/lispobject.h"
 
+#include <vector>
+
+namespace {
+    // set when the queue of the thread is gone; objects still freed
+    // afterwards (by destructors of statics) are deleted right away
+    thread_local bool queue_destroyed = false;
+
+    // objects whose last reference went away, waiting to be deleted
+    struct ReclaimQueue {
+        ReclaimQueue(): budget(0), busy(false) {}
+
+        ~ReclaimQueue()
+        {
+            busy = true;
+            while (!pending.empty()) {
+                LispObject* object = pending.back();
+                pending.pop_back();
+                delete object;
+            }
+            queue_destroyed = true;
+        }
+
+        std::vector<LispObject*> pending;
+        std::size_t budget;
+        bool busy;
+    };
+
+    thread_local ReclaimQueue queue;
+}
+
+LispObject::~LispObject()
+{
+    Dispose(iNext);
+
+    if (!queue_destroyed && !queue.busy)
+        Reclaim(queue.budget ? queue.budget : static_cast<std::size_t>(-1));
+}
+
+void LispObject::Dispose(LispPtr& aPtr)
+{
+    LispObject* object = aPtr.release();
+
+    if (object && --object->iReferenceCount == 0) {
+        if (queue_destroyed)
+            delete object;
+        else
+            queue.pending.push_back(object);
+    }
+}
+
+void LispObject::SetReclaimBudget(std::size_t aObjects)
+{
+    if (!queue_destroyed)
+        queue.budget = aObjects;
+}
+
+std::size_t LispObject::Reclaim(std::size_t aObjects)
+{
+    if (queue_destroyed)
+        return 0;
+
+    // objects deleted from here only add their parts to the queue
+    if (queue.busy)
+        return queue.pending.size();
+
+    queue.busy = true;
+
+    for (; aObjects && !queue.pending.empty(); --aObjects) {
+        LispObject* object = queue.pending.back();
+        queue.pending.pop_back();
+        delete object;
+    }
+
+    queue.busy = false;
+
+    return queue.pending.size();
+}
+
 int LispObject::Equal(LispObject& aOther)
 {
     // next line handles the fact that either one is a string
@@ -27,3 +105,24 @@ int LispObject::Equal(LispObject& aOther)
 }
 
 
+
+void LispObject::Freeze(int aPrecision)
+{
+    // Walk the Nixed() chains iteratively, lists in the rule bases can
+    // be long. A frozen object has its tail frozen already, so shared
+    // subexpressions are only visited once.
+    std::vector<LispObject*> todo(1, this);
+
+    while (!todo.empty()) {
+        LispObject* object = todo.back();
+        todo.pop_back();
+
+        for (; object && !object->iReferenceCount.IsFrozen(); object = object->iNext) {
+            object->FreezeData(aPrecision);
+            object->iReferenceCount.Freeze();
+
+            if (LispPtr* subList = object->SubList())
+                todo.push_back(*subList);
+        }
+    }
+}
@@ -0,0 +1,546 @@
+#include "yacas/lispstackeval.h"
+
+#include "yacas/errors.h"
+#include "yacas/lispevalhash.h"
+#include "yacas/lispparser.h"
+#include "yacas/mathcommands.h"
+#include "yacas/mathuserfunc.h"
+#include "yacas/standard.h"
+
+#include <algorithm>
+#include <limits>
+#include <typeinfo>
+#include <utility>
+
+namespace {
+    // The depth of an expression being evaluated, which is given back
+    // unless a frame takes it over.
+    class Depth {
+    public:
+        explicit Depth(LispEnvironment& aEnvironment):
+            iEnvironment(aEnvironment), iKept(false)
+        {
+            ++aEnvironment.iEvalDepth;
+        }
+
+        ~Depth()
+        {
+            if (!iKept)
+                --iEnvironment.iEvalDepth;
+        }
+
+        void Keep() { iKept = true; }
+
+    private:
+        LispEnvironment& iEnvironment;
+        bool iKept;
+    };
+}
+
+StackEvaluator::Frame::Frame(Kind aKind, LispPtr& aExpression):
+    iKind(aKind),
+    iExpression(aExpression),
+    iNext(&(*aExpression->SubList())->Nixed()),
+    iPending(false),
+    iLocals(false),
+    iIndex(0),
+    iCore(nullptr),
+    iStackTop(0),
+    iFunction(nullptr),
+    iPrecedence(-1),
+    iTail(nullptr)
+{
+}
+
+StackEvaluator::StackEvaluator():
+    iBase(0)
+{
+}
+
+void StackEvaluator::Eval(LispEnvironment& aEnvironment, LispPtr& aResult, LispPtr& aExpression)
+{
+    assert(aExpression);
+
+    const std::size_t base = iFrames.size();
+
+    if (!Push(aEnvironment, aExpression))
+        Run(aEnvironment, base, std::numeric_limits<std::size_t>::max());
+
+    aResult = iValue;
+    iValue = nullptr;
+}
+
+void StackEvaluator::Start(LispEnvironment& aEnvironment, LispPtr& aExpression)
+{
+    assert(iFrames.empty());
+
+    iValue = nullptr;
+    Push(aEnvironment, aExpression);
+}
+
+bool StackEvaluator::Resume(LispEnvironment& aEnvironment, LispPtr& aResult, std::size_t aSteps)
+{
+    if (!Run(aEnvironment, 0, aSteps))
+        return false;
+
+    aResult = iValue;
+    iValue = nullptr;
+
+    return true;
+}
+
+void StackEvaluator::Abandon(LispEnvironment& aEnvironment)
+{
+    Unwind(aEnvironment, 0);
+    iValue = nullptr;
+}
+
+bool StackEvaluator::Run(LispEnvironment& aEnvironment, std::size_t aBase, std::size_t aSteps)
+{
+    const std::size_t base = iBase;
+    iBase = aBase;
+
+    try {
+        while (iFrames.size() > aBase) {
+            if (aSteps == 0) {
+                iBase = base;
+                return false;
+            }
+            --aSteps;
+            Step(aEnvironment);
+        }
+    } catch (...) {
+        Unwind(aEnvironment, aBase);
+        iBase = base;
+        throw;
+    }
+
+    iBase = base;
+    return true;
+}
+
+// As BasicEvaluator::Eval(), except that the evaluation of lists
+// which can be carried out in frames is only started.
+bool StackEvaluator::Push(LispEnvironment& aEnvironment, LispPtr& aExpression)
+{
+    Depth depth(aEnvironment);
+    if (aEnvironment.iEvalDepth >= aEnvironment.iMaxEvalDepth) {
+        ShowStack(aEnvironment, aEnvironment.CurrentOutput());
+        throw LispErrMaxRecurseDepthReached();
+    }
+
+    if (const LispString* str = aExpression->String()) {
+        if (str->front() == '\"') {
+            iValue = aExpression->Copy();
+            return true;
+        }
+
+        LispPtr val;
+        aEnvironment.GetVariable(str, val);
+        if (!val)
+            iValue = aExpression->Copy();
+        else if (val->Nixed())
+            iValue = val->Copy();
+        else
+            iValue = val;
+        return true;
+    }
+
+    LispPtr* subList = aExpression->SubList();
+
+    if (!subList || !*subList) {
+        iValue = aExpression->Copy();
+        return true;
+    }
+
+    LispObject* head = *subList;
+
+    aEnvironment.Safepoint();
+
+    if (!head->String()) {
+        LispPtr oper(*subList);
+        LispPtr args2((*subList)->Nixed());
+        LispPtr result;
+        InternalApplyPure(oper, args2, result, aEnvironment);
+        iValue = result;
+        return true;
+    }
+
+    std::size_t nrArgs = 0;
+    for (LispObject* arg = head->Nixed(); arg; arg = arg->Nixed())
+        ++nrArgs;
+
+    if (const YacasEvaluator* core = aEnvironment.CoreCommand(head->String())) {
+        if (core->Caller() == LispIf && (nrArgs == 2 || nrArgs == 3)) {
+            iFrames.emplace_back(Frame::If, aExpression);
+        } else if (core->Caller() == LispProgBody) {
+            iFrames.emplace_back(Frame::Prog, aExpression);
+            aEnvironment.PushLocalFrame(false);
+            iFrames.back().iLocals = true;
+        } else if (core->Caller() == LispList) {
+            iFrames.emplace_back(Frame::List, aExpression);
+            Frame& frame = iFrames.back();
+            frame.iList = head->Copy();
+            frame.iTail = &frame.iList->Nixed();
+        } else if (!(core->Flags() & YacasEvaluator::Macro) &&
+                   ((core->Flags() & YacasEvaluator::Variable) ?
+                    static_cast<int>(nrArgs) + 1 >= core->NrArgs() :
+                    static_cast<int>(nrArgs) == core->NrArgs())) {
+            iFrames.emplace_back(Frame::CoreArguments, aExpression);
+            Frame& frame = iFrames.back();
+            frame.iCore = core;
+            frame.iStackTop = aEnvironment.iStack.size();
+            // the expression is the place holder for the result, as
+            // in YacasEvaluator::Evaluate()
+            aEnvironment.iStack.push_back(*subList);
+        } else {
+            LispPtr result;
+            core->Evaluate(result, aEnvironment, *subList);
+            iValue = result;
+            return true;
+        }
+
+        depth.Keep();
+        return false;
+    }
+
+    LispUserFunction* userFunc = GetUserFunction(aEnvironment, subList);
+
+    if (!userFunc) {
+        iFrames.emplace_back(Frame::List, aExpression);
+        Frame& frame = iFrames.back();
+        frame.iList = head->Copy();
+        frame.iTail = &frame.iList->Nixed();
+    } else if (typeid(*userFunc) == typeid(BranchingUserFunction) && !userFunc->Traced() &&
+               !static_cast<const BranchingUserFunction*>(userFunc)->Memoized()) {
+        iFrames.emplace_back(Frame::UserArguments, aExpression);
+        Frame& frame = iFrames.back();
+        frame.iFunction = static_cast<const BranchingUserFunction*>(userFunc);
+        frame.iArguments.resize(nrArgs);
+    } else {
+        LispPtr result;
+        userFunc->Evaluate(result, aEnvironment, *subList);
+        iValue = result;
+        return true;
+    }
+
+    depth.Keep();
+    return false;
+}
+
+void StackEvaluator::Step(LispEnvironment& aEnvironment)
+{
+    const std::size_t index = iFrames.size() - 1;
+
+    bool done = false;
+
+    switch (iFrames[index].iKind) {
+    case Frame::CoreArguments:
+        done = StepCoreArguments(aEnvironment, index);
+        break;
+    case Frame::UserArguments:
+        done = StepUserArguments(aEnvironment, index);
+        break;
+    case Frame::Body:
+        // the value of the body is the value of the call
+        done = true;
+        break;
+    case Frame::If:
+        done = StepIf(aEnvironment, index);
+        break;
+    case Frame::Prog:
+        done = StepProg(aEnvironment, index);
+        break;
+    case Frame::List:
+        done = StepList(aEnvironment, index);
+        break;
+    }
+
+    if (done)
+        Pop(aEnvironment);
+}
+
+void StackEvaluator::Pop(LispEnvironment& aEnvironment)
+{
+    if (iFrames.back().iLocals)
+        aEnvironment.PopLocalFrame();
+
+    iFrames.pop_back();
+    --aEnvironment.iEvalDepth;
+}
+
+void StackEvaluator::Unwind(LispEnvironment& aEnvironment, std::size_t aBase)
+{
+    while (iFrames.size() > aBase) {
+        Frame& frame = iFrames.back();
+        if (frame.iKind == Frame::CoreArguments)
+            aEnvironment.iStack.resize(frame.iStackTop);
+        Pop(aEnvironment);
+    }
+}
+
+void StackEvaluator::TailCall(LispEnvironment& aEnvironment)
+{
+    const std::size_t index = iFrames.size() - 1;
+
+    // the frames of an outer run belong to a native caller, which
+    // expects to find them when the nested run is done
+    std::size_t first = index;
+    while (first > iBase) {
+        const Frame& frame = iFrames[first - 1];
+        if (!frame.iPending)
+            break;
+        if (frame.iKind != Frame::Body &&
+            !(frame.iKind == Frame::If && frame.iIndex == 1) &&
+            !(frame.iKind == Frame::Prog && !*frame.iNext))
+            break;
+        --first;
+    }
+
+    if (first == index)
+        return;
+
+    for (std::size_t i = index; i > first; --i) {
+        if (iFrames[i - 1].iLocals)
+            aEnvironment.PopLocalFrame();
+        --aEnvironment.iEvalDepth;
+    }
+
+    iFrames.erase(iFrames.begin() + first, iFrames.begin() + index);
+}
+
+// as YacasEvaluator::Evaluate() for a function
+bool StackEvaluator::StepCoreArguments(LispEnvironment& aEnvironment, std::size_t aIndex)
+{
+    Frame* frame = &iFrames[aIndex];
+    const std::size_t nrArgs = frame->iCore->NrArgs();
+    const std::size_t nrFixed = (frame->iCore->Flags() & YacasEvaluator::Variable) ? nrArgs - 1 : nrArgs;
+
+    if (frame->iPending) {
+        frame->iPending = false;
+        aEnvironment.iStack.push_back(std::move(iValue));
+    }
+
+    while (frame->iIndex < nrArgs) {
+        frame->iPending = true;
+        if (frame->iIndex++ < nrFixed) {
+            LispPtr& argument = *frame->iNext;
+            frame->iNext = &argument->Nixed();
+            if (!Push(aEnvironment, argument))
+                return false;
+        } else {
+            // the remaining arguments, as a list
+            LispPtr head(aEnvironment.iList->Copy());
+            head->Nixed() = *frame->iNext;
+            LispPtr list(LispSubList::New(head));
+            if (!Push(aEnvironment, list))
+                return false;
+        }
+        frame = &iFrames[aIndex];
+        frame->iPending = false;
+        aEnvironment.iStack.push_back(std::move(iValue));
+    }
+
+    const int stacktop = frame->iStackTop;
+    frame->iCore->Caller()(aEnvironment, stacktop);
+    iValue = std::move(aEnvironment.iStack[stacktop]);
+    aEnvironment.iStack.resize(stacktop);
+
+    return true;
+}
+
+// as BranchingUserFunction::Evaluate()
+bool StackEvaluator::StepUserArguments(LispEnvironment& aEnvironment, std::size_t aIndex)
+{
+    Frame* frame = &iFrames[aIndex];
+    const BranchingUserFunction& function = *frame->iFunction;
+    const std::size_t arity = frame->iArguments.size();
+
+    if (frame->iPending) {
+        frame->iPending = false;
+        frame->iArguments[frame->iIndex++] = iValue;
+    }
+
+    while (frame->iIndex < arity) {
+        LispPtr& argument = *frame->iNext;
+        frame->iNext = &argument->Nixed();
+        if (function.Held(frame->iIndex)) {
+            frame->iArguments[frame->iIndex++] = argument->Copy();
+            continue;
+        }
+        frame->iPending = true;
+        if (!Push(aEnvironment, argument))
+            return false;
+        frame = &iFrames[aIndex];
+        frame->iPending = false;
+        frame->iArguments[frame->iIndex++] = iValue;
+    }
+
+    // an unfenced function sees the local variables of the caller,
+    // so it has to be called from within the body
+    if (function.Fenced())
+        TailCall(aEnvironment);
+
+    aEnvironment.PushLocalFrame(function.Fenced());
+    iFrames.back().iLocals = true;
+
+    // the predicates may push frames, which moves the frames around
+    std::vector<LispPtr> arguments;
+    arguments.swap(iFrames.back().iArguments);
+
+    BranchingUserFunction::BranchRuleBase* rule = function.MatchRule(aEnvironment, arguments.data());
+
+    frame = &iFrames.back();
+
+    if (!rule) {
+        function.Unevaluated(iValue, *frame->iExpression->SubList(), arguments.data());
+        return true;
+    }
+
+    frame->iKind = Frame::Body;
+    frame->iPrecedence = rule->Precedence();
+    frame->iPending = true;
+
+    LispPtr body(rule->Body());
+    return Push(aEnvironment, body);
+}
+
+// as LispIf()
+bool StackEvaluator::StepIf(LispEnvironment& aEnvironment, std::size_t aIndex)
+{
+    Frame* frame = &iFrames[aIndex];
+
+    // the value of the branch
+    if (frame->iIndex == 1)
+        return true;
+
+    if (!frame->iPending) {
+        frame->iPending = true;
+        if (!Push(aEnvironment, *frame->iNext))
+            return false;
+        frame = &iFrames[aIndex];
+    }
+
+    frame->iPending = false;
+
+    LispPtr* branch = &(*frame->iNext)->Nixed();
+
+    if (!IsTrue(aEnvironment, iValue)) {
+        if (!IsFalse(aEnvironment, iValue)) {
+            const int stacktop = aEnvironment.iStack.size();
+            aEnvironment.iStack.push_back(*frame->iExpression->SubList());
+            CheckArg(false, 1, aEnvironment, stacktop);
+        }
+
+        branch = &(*branch)->Nixed();
+
+        if (!*branch) {
+            InternalFalse(aEnvironment, iValue);
+            return true;
+        }
+    }
+
+    frame->iIndex = 1;
+    frame->iPending = true;
+
+    return Push(aEnvironment, *branch);
+}
+
+// as LispProgBody()
+bool StackEvaluator::StepProg(LispEnvironment& aEnvironment, std::size_t aIndex)
+{
+    Frame* frame = &iFrames[aIndex];
+
+    if (frame->iPending) {
+        frame->iPending = false;
+    } else if (!*frame->iNext) {
+        InternalTrue(aEnvironment, iValue);
+        return true;
+    }
+
+    while (!!*frame->iNext) {
+        LispPtr& statement = *frame->iNext;
+        frame->iNext = &statement->Nixed();
+        frame->iPending = true;
+        if (!Push(aEnvironment, statement))
+            return false;
+        frame = &iFrames[aIndex];
+        frame->iPending = false;
+    }
+
+    return true;
+}
+
+// as LispList() and ReturnUnEvaluated()
+bool StackEvaluator::StepList(LispEnvironment& aEnvironment, std::size_t aIndex)
+{
+    Frame* frame = &iFrames[aIndex];
+
+    if (frame->iPending) {
+        frame->iPending = false;
+        Detach(iValue);
+        *frame->iTail = iValue;
+        frame->iTail = &iValue->Nixed();
+    }
+
+    while (!!*frame->iNext) {
+        LispPtr& argument = *frame->iNext;
+        frame->iNext = &argument->Nixed();
+        frame->iPending = true;
+        if (!Push(aEnvironment, argument))
+            return false;
+        frame = &iFrames[aIndex];
+        frame->iPending = false;
+        Detach(iValue);
+        *frame->iTail = iValue;
+        frame->iTail = &iValue->Nixed();
+    }
+
+    *frame->iTail = nullptr;
+    iValue = LispSubList::New(frame->iList);
+
+    return true;
+}
+
+void StackEvaluator::ShowFrames(LispEnvironment& aEnvironment, std::ostream& aOutput, std::size_t aCount) const
+{
+    const std::size_t upto = iFrames.size();
+
+    for (std::size_t i = upto - std::min(aCount, upto); i < upto; ++i) {
+        const Frame& frame = iFrames[i];
+        LispPtr head(*frame.iExpression->SubList());
+
+        aOutput << i << ": ";
+        aEnvironment.CurrentPrinter().Print(head, aOutput, aEnvironment);
+
+        switch (frame.iKind) {
+        case Frame::CoreArguments:
+        case Frame::If:
+        case Frame::Prog:
+            aOutput << " (Internal function) ";
+            break;
+        case Frame::List:
+            if (aEnvironment.CoreCommand(head->String()))
+                aOutput << " (Internal function) ";
+            else
+                aOutput << " (User function) ";
+            break;
+        case Frame::Body:
+            aOutput << " (Rule # " << frame.iPrecedence << " in body) ";
+            break;
+        case Frame::UserArguments:
+            aOutput << " (User function) ";
+            break;
+        }
+
+        LispString expr;
+        LispPtr expression(frame.iExpression);
+        PrintExpression(expr, expression, aEnvironment, 60);
+        aOutput << "\n      " << expr << '\n';
+    }
+}
+
+void StackEvaluator::ShowStack(LispEnvironment& aEnvironment, std::ostream& aOutput)
+{
+    ShowFrames(aEnvironment, aOutput, SHOWN_FRAMES);
+}
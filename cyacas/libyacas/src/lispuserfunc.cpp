@@ -29,12 +29,22 @@ void LispMultiUserFunction::DeleteBase(int aArity)
         {
             delete iFunctions[i];
             iFunctions.erase(iFunctions.begin() + i);
+            Forget();
             return;
         }
     }
 }
 
 
+LispMultiUserFunction::LispMultiUserFunction(const LispMultiUserFunction& aOther):
+    iFunctions(),
+    iFileToOpen(aOther.iFileToOpen)
+{
+    iFunctions.reserve(aOther.iFunctions.size());
+    for (const LispArityUserFunction* p: aOther.iFunctions)
+        iFunctions.push_back(p->Clone());
+}
+
 LispMultiUserFunction::~LispMultiUserFunction()
 {
     for (LispArityUserFunction* p: iFunctions)
@@ -48,6 +58,19 @@ void LispMultiUserFunction::HoldArgument(const LispString* aVariable)
         assert(iFunctions[i]);
         iFunctions[i]->HoldArgument(aVariable);
     }
+    Forget();
+}
+
+void LispMultiUserFunction::Freeze(int aPrecision)
+{
+    for (LispArityUserFunction* p: iFunctions)
+        p->Freeze(aPrecision);
+}
+
+void LispMultiUserFunction::Forget()
+{
+    for (LispArityUserFunction* p: iFunctions)
+        p->Forget();
 }
 
 void LispMultiUserFunction::DefineRuleBase(LispArityUserFunction* aNewFunction)
@@ -62,6 +85,7 @@ void LispMultiUserFunction::DefineRuleBase(LispArityUserFunction* aNewFunction)
             throw LispErrArityAlreadyDefined();
 
     }
+    Forget();
     iFunctions.push_back(aNewFunction);
 }
 
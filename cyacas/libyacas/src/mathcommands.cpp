@@ -2,7 +2,9 @@
 #include "yacas/lispenvironment.h"
 #include "yacas/standard.h"
 #include "yacas/lispeval.h"
+#include "yacas/lispstackeval.h"
 #include "yacas/lispatom.h"
+#include "yacas/lisparena.h"
 #include "yacas/lispparser.h"
 #include "yacas/platfileio.h"
 #include "yacas/stringio.h"
@@ -162,11 +164,23 @@ void LispStrictTotalOrder(LispEnvironment& aEnvironment, int aStackTop)
 
 void LispLessThan(LispEnvironment& aEnvironment, int aStackTop)
 {
+    long a, b;
+    if (ARGUMENT(1)->SmallInteger(a) && ARGUMENT(2)->SmallInteger(b)) {
+        InternalBoolean(aEnvironment, RESULT, a < b);
+        return;
+    }
+
     LispLexCompare2(aEnvironment, aStackTop, LexLessThan, BigLessThan);
 }
 
 void LispGreaterThan(LispEnvironment& aEnvironment, int aStackTop)
 {
+    long a, b;
+    if (ARGUMENT(1)->SmallInteger(a) && ARGUMENT(2)->SmallInteger(b)) {
+        InternalBoolean(aEnvironment, RESULT, a > b);
+        return;
+    }
+
     LispLexCompare2(aEnvironment, aStackTop, LexGreaterThan, BigGreaterThan);
 }
 
@@ -258,12 +272,39 @@ void LispListify(LispEnvironment& aEnvironment, int aStackTop)
 
 
 
+// The destructive list operations relink the elements of the list
+// aList in place, which invalidates the hashes of the lists. Frozen
+// lists are shared: the variables holding one get a copy first, and a
+// list no variable holds is copied instead.
+static void InternalDestructiveTarget(LispEnvironment& aEnvironment, LispPtr& aResult, LispPtr& aList)
+{
+    LispSubList::Modified();
+
+    aEnvironment.Thaw(aList);
+
+    const LispPtr& original = *aList->SubList();
+
+    for (LispConstIterator iter(original); iter.getObj(); ++iter) {
+        if (iter.getObj()->iReferenceCount.IsFrozen()) {
+            InternalFlatCopy(aResult, original);
+            return;
+        }
+    }
+
+    aResult = original;
+}
+
 void LispDestructiveReverse(LispEnvironment& aEnvironment, int aStackTop)
 {
     CheckArgIsList(1, aEnvironment, aStackTop);
 
+  LispPtr list(ARGUMENT(1));
+  LispPtr target;
+  InternalDestructiveTarget(aEnvironment, target, list);
+  LispPtr original(target->Nixed());
+
   LispPtr reversed(aEnvironment.iList->Copy());
-  InternalReverseList(reversed->Nixed(), (*ARGUMENT(1)->SubList())->Nixed());
+  InternalReverseList(reversed->Nixed(), original);
   RESULT = (LispSubList::New(reversed));
 }
 
@@ -296,6 +337,7 @@ void LispList(LispEnvironment& aEnvironment, int aStackTop)
   {
     LispPtr evaluated;
     InternalEval(aEnvironment,evaluated,*iter);
+    Detach(evaluated);
   // Ideally this would work, but it does not yet: (*tail++) = (evaluated)
     (*tail) = (evaluated);
     ++tail;
@@ -344,7 +386,7 @@ static void InternalDelete(LispEnvironment& aEnvironment, int aStackTop, int aDe
     LispPtr copied;
     if (aDestructive)
     {
-        copied = ((*evaluated->SubList()));
+        InternalDestructiveTarget(aEnvironment, copied, evaluated);
     }
     else
     {
@@ -399,7 +441,7 @@ static void InternalInsert(LispEnvironment& aEnvironment, int aStackTop, int aDe
     LispPtr copied;
     if (aDestructive)
     {
-        copied = ((*evaluated->SubList()));
+        InternalDestructiveTarget(aEnvironment, copied, evaluated);
     }
     else
     {
@@ -414,6 +456,7 @@ static void InternalInsert(LispEnvironment& aEnvironment, int aStackTop, int aDe
 
     LispIterator iter(copied);
     while (--ind>=0) ++iter;
+    Detach(ARGUMENT(3));
     LispPtr toInsert(ARGUMENT(3));
     toInsert->Nixed() = (iter.getObj());
     (*iter) = (toInsert);
@@ -445,7 +488,7 @@ static void InternalReplace(LispEnvironment& aEnvironment, int aStackTop, int aD
     LispPtr copied;
     if (aDestructive)
     {
-        copied = ((*evaluated->SubList()));
+        InternalDestructiveTarget(aEnvironment, copied, evaluated);
     }
     else
     {
@@ -455,6 +498,7 @@ static void InternalReplace(LispEnvironment& aEnvironment, int aStackTop, int aD
 
     LispIterator iter(copied);
     while (--ind>=0) ++iter;
+    Detach(ARGUMENT(3));
     LispPtr toInsert(ARGUMENT(3));
     CheckArg(iter.getObj(), 2, aEnvironment, aStackTop);
 
@@ -476,6 +520,7 @@ void LispDestructiveReplace(LispEnvironment& aEnvironment, int aStackTop)
 
 void LispNot(LispEnvironment& aEnvironment, int aStackTop)
 {
+    Detach(ARGUMENT(1));
     LispPtr evaluated(ARGUMENT(1));
     if (IsTrue(aEnvironment, evaluated) || IsFalse(aEnvironment, evaluated))
     {
@@ -675,6 +720,7 @@ void LispWhile(LispEnvironment& aEnvironment, int aStackTop)
         LispPtr evaluated;
         InternalEval(aEnvironment, evaluated, arg2);
         InternalEval(aEnvironment, predicate, arg1);
+        aEnvironment.Safepoint();
     }
     CheckArg(IsFalse(aEnvironment, predicate), 1, aEnvironment, aStackTop);
     InternalTrue(aEnvironment,RESULT);
@@ -1021,23 +1067,14 @@ void LispIsAtom(LispEnvironment& aEnvironment,int aStackTop)
 
 void LispIsNumber(LispEnvironment& aEnvironment,int aStackTop)
 {
-  LispPtr result(ARGUMENT(1));
-  InternalBoolean(aEnvironment, RESULT, result->Number(aEnvironment.Precision()) != nullptr);
+  // only numbers have a BigNumber, but a small integer doesn't need one
+  InternalBoolean(aEnvironment, RESULT, dynamic_cast<LispNumber*>(ARGUMENT(1).ptr()) != nullptr);
 }
 
 void LispIsInteger(LispEnvironment& aEnvironment,int aStackTop)
 {
-  LispPtr result(ARGUMENT(1));
-
-  RefPtr<BigNumber> num ; num = result->Number(aEnvironment.Precision());
-  if (!num)
-  {
-    InternalFalse(aEnvironment,RESULT);
-  }
-  else
-  {
-    InternalBoolean(aEnvironment, RESULT, num->IsInt());
-  }
+  LispNumber* number = dynamic_cast<LispNumber*>(ARGUMENT(1).ptr());
+  InternalBoolean(aEnvironment, RESULT, number && number->IsInt());
 }
 
 void LispIsList(LispEnvironment& aEnvironment,int aStackTop)
@@ -1115,6 +1152,66 @@ void LispRetract(LispEnvironment& aEnvironment, int aStackTop)
     InternalTrue(aEnvironment,RESULT);
 }
 
+// the number of results Memoize() remembers
+static const std::size_t MEMOIZE_LIMIT = 10000;
+
+static BranchingUserFunction* InternalMemoizableRule(LispEnvironment& aEnvironment, int aStackTop)
+{
+    // Get operator
+    CheckArg(ARGUMENT(1), 1, aEnvironment, aStackTop);
+    const LispString* orig = ARGUMENT(1)->String();
+    CheckArg(orig, 1, aEnvironment, aStackTop);
+
+    // The arity
+    CheckArg(ARGUMENT(2), 2, aEnvironment, aStackTop);
+    CheckArg(ARGUMENT(2)->String(), 2, aEnvironment, aStackTop);
+    int arity = InternalAsciiToInt(*ARGUMENT(2)->String());
+
+    return aEnvironment.MemoizableRule(SymbolName(aEnvironment,*orig), arity);
+}
+
+void LispMemoize(LispEnvironment& aEnvironment, int aStackTop)
+{
+    BranchingUserFunction* userFunc = InternalMemoizableRule(aEnvironment, aStackTop);
+
+    if (!userFunc->Memoized())
+        userFunc->Memoize(MEMOIZE_LIMIT);
+
+    InternalTrue(aEnvironment,RESULT);
+}
+
+void LispMemoizeLimit(LispEnvironment& aEnvironment, int aStackTop)
+{
+    BranchingUserFunction* userFunc = InternalMemoizableRule(aEnvironment, aStackTop);
+
+    CheckArg(ARGUMENT(3), 3, aEnvironment, aStackTop);
+    CheckArg(ARGUMENT(3)->String(), 3, aEnvironment, aStackTop);
+    int limit = InternalAsciiToInt(*ARGUMENT(3)->String());
+    CheckArg(limit >= 0, 3, aEnvironment, aStackTop);
+
+    userFunc->Memoize(limit);
+
+    InternalTrue(aEnvironment,RESULT);
+}
+
+void LispUnMemoize(LispEnvironment& aEnvironment, int aStackTop)
+{
+    InternalMemoizableRule(aEnvironment, aStackTop)->UnMemoize();
+
+    InternalTrue(aEnvironment,RESULT);
+}
+
+void LispMemoizeStatistics(LispEnvironment& aEnvironment, int aStackTop)
+{
+    const LispMemoTable* memo = InternalMemoizableRule(aEnvironment, aStackTop)->MemoTable();
+    CheckArg(memo, 1, aEnvironment, aStackTop);
+
+    RESULT = LispSubList::New(LispObjectAdder(aEnvironment.iList->Copy()) +
+                              LispObjectAdder(LispAtom::New(aEnvironment, std::to_string(memo->Hits()))) +
+                              LispObjectAdder(LispAtom::New(aEnvironment, std::to_string(memo->Misses()))) +
+                              LispObjectAdder(LispAtom::New(aEnvironment, std::to_string(memo->Size()))));
+}
+
 void YacasBuiltinPrecisionSet(LispEnvironment& aEnvironment, int aStackTop)
 {
     LispPtr index(ARGUMENT(1));
@@ -1268,6 +1365,10 @@ void LispTrapError(LispEnvironment& aEnvironment,int aStackTop)
 {
     try {
         InternalEval(aEnvironment, RESULT, ARGUMENT(1));
+    } catch (const LispErrTimeout&) {
+        // the whole evaluation is given up, see
+        // LispEnvironment::SetDeadline()
+        throw;
     } catch (const LispError& error) {
         HandleError(error, aEnvironment, aEnvironment.iErrorOutput);
     }
@@ -1324,6 +1425,20 @@ void LispMaxEvalDepth(LispEnvironment& aEnvironment, int aStackTop)
     InternalTrue(aEnvironment,RESULT);
 }
 
+void LispMemoryUsage(LispEnvironment& aEnvironment, int aStackTop)
+{
+    const LispArena* arena = LispArena::Current();
+
+    RESULT = LispAtom::New(aEnvironment, std::to_string(arena ? arena->Stats().live_bytes : 0));
+}
+
+void LispAllocationCount(LispEnvironment& aEnvironment, int aStackTop)
+{
+    const LispArena* arena = LispArena::Current();
+
+    RESULT = LispAtom::New(aEnvironment, std::to_string(arena ? arena->Stats().allocations : 0));
+}
+
 void LispDefLoad(LispEnvironment& aEnvironment, int aStackTop)
 {
     CheckSecure(aEnvironment, aStackTop);
@@ -1367,6 +1482,50 @@ void LispRightAssociative(LispEnvironment& aEnvironment, int aStackTop)
     InternalTrue(aEnvironment,RESULT);
 }
 
+void LispAssociative(LispEnvironment& aEnvironment, int aStackTop)
+{
+    CheckArg(ARGUMENT(1), 1, aEnvironment, aStackTop);
+    const LispString* orig = ARGUMENT(1)->String();
+    CheckArg(orig, 1, aEnvironment, aStackTop);
+
+    aEnvironment.SetAssociative(SymbolName(aEnvironment, *orig));
+
+    InternalTrue(aEnvironment,RESULT);
+}
+
+void LispCommutative(LispEnvironment& aEnvironment, int aStackTop)
+{
+    CheckArg(ARGUMENT(1), 1, aEnvironment, aStackTop);
+    const LispString* orig = ARGUMENT(1)->String();
+    CheckArg(orig, 1, aEnvironment, aStackTop);
+
+    aEnvironment.SetCommutative(SymbolName(aEnvironment, *orig));
+
+    InternalTrue(aEnvironment,RESULT);
+}
+
+void LispUnAssociative(LispEnvironment& aEnvironment, int aStackTop)
+{
+    CheckArg(ARGUMENT(1), 1, aEnvironment, aStackTop);
+    const LispString* orig = ARGUMENT(1)->String();
+    CheckArg(orig, 1, aEnvironment, aStackTop);
+
+    aEnvironment.SetAssociative(SymbolName(aEnvironment, *orig), false);
+
+    InternalTrue(aEnvironment,RESULT);
+}
+
+void LispUnCommutative(LispEnvironment& aEnvironment, int aStackTop)
+{
+    CheckArg(ARGUMENT(1), 1, aEnvironment, aStackTop);
+    const LispString* orig = ARGUMENT(1)->String();
+    CheckArg(orig, 1, aEnvironment, aStackTop);
+
+    aEnvironment.SetCommutative(SymbolName(aEnvironment, *orig), false);
+
+    InternalTrue(aEnvironment,RESULT);
+}
+
 void LispLeftPrecedence(LispEnvironment& aEnvironment, int aStackTop)
 {
     // Get operator
@@ -1653,6 +1812,10 @@ void GenArraySet(LispEnvironment& aEnvironment,int aStackTop)
   int size = InternalAsciiToInt(*sizearg->String());
 
   CheckArg(size > 0 && static_cast<std::size_t>(size) <= arr->Size(), 2, aEnvironment, aStackTop);
+
+  if (arr->iReferenceCount.IsFrozen())
+      throw LispErrFrozenObject();
+
   LispPtr obj(ARGUMENT(3));
   arr->SetElement(size,obj);
 
@@ -1713,6 +1876,9 @@ void GenAssociationSet(LispEnvironment& aEnvironment,int aStackTop)
   AssociationClass* a = dynamic_cast<AssociationClass*>(gen);
   CheckArg(a, 1, aEnvironment, aStackTop);
 
+  if (a->iReferenceCount.IsFrozen())
+      throw LispErrFrozenObject();
+
   LispPtr k(ARGUMENT(2));
   LispPtr v(ARGUMENT(3));
 
@@ -1728,6 +1894,9 @@ void GenAssociationDrop(LispEnvironment& aEnvironment,int aStackTop)
     AssociationClass* a = dynamic_cast<AssociationClass*>(gen);
     CheckArg(a, 1, aEnvironment, aStackTop);
 
+    if (a->iReferenceCount.IsFrozen())
+        throw LispErrFrozenObject();
+
     LispPtr k(ARGUMENT(2));
     if (a->DropElement(k))
         InternalTrue(aEnvironment,RESULT);
@@ -1811,6 +1980,12 @@ void LispCustomEvalStop(LispEnvironment& aEnvironment,int aStackTop)
 
 void LispTraceStack(LispEnvironment& aEnvironment,int aStackTop)
 {
+    // the stack evaluator shows its own frames
+    if (dynamic_cast<StackEvaluator*>(aEnvironment.iEvaluator)) {
+        InternalEval(aEnvironment, RESULT, ARGUMENT(1));
+        return;
+    }
+
     LispLocalEvaluator local(aEnvironment,new TracedStackEvaluator);
     InternalEval(aEnvironment, RESULT, ARGUMENT(1));
 }
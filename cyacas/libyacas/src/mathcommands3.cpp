@@ -22,6 +22,7 @@
 
 #include "yacas/yacas_version.h"
 
+#include <limits>
 #include <sstream>
 
 
@@ -43,6 +44,51 @@ void GetNumber(RefPtr<BigNumber>& x, LispEnvironment& aEnvironment, int aStackTo
     CheckArg(x, aArgNr, aEnvironment, aStackTop);
 }
 
+/// Fetch two small integer arguments, see LispObject::SmallInteger().
+static inline bool GetSmallIntegers(long& x, long& y, LispEnvironment& aEnvironment, int aStackTop)
+{
+    return ARGUMENT(1)->SmallInteger(x) && ARGUMENT(2)->SmallInteger(y);
+}
+
+/// Overflow-checked arithmetic on small integers. On overflow, false
+/// is returned and the caller has to fall back to BigNumber.
+static inline bool SmallAdd(long x, long y, long& z)
+{
+    if ((y > 0 && x > std::numeric_limits<long>::max() - y) ||
+        (y < 0 && x < std::numeric_limits<long>::min() - y))
+        return false;
+
+    z = x + y;
+    return true;
+}
+
+static inline bool SmallSubtract(long x, long y, long& z)
+{
+    if ((y < 0 && x > std::numeric_limits<long>::max() + y) ||
+        (y > 0 && x < std::numeric_limits<long>::min() + y))
+        return false;
+
+    z = x - y;
+    return true;
+}
+
+static inline bool SmallMultiply(long x, long y, long& z)
+{
+    const long max = std::numeric_limits<long>::max();
+    const long min = std::numeric_limits<long>::min();
+
+    if (x > 0) {
+        if ((y > 0 && x > max / y) || (y < 0 && y < min / x))
+            return false;
+    } else if (x < 0) {
+        if ((y > 0 && x < min / y) || (y < 0 && y < max / x))
+            return false;
+    }
+
+    z = x * y;
+    return true;
+}
+
 //FIXME remove these
 void LispArithmetic2(LispEnvironment& aEnvironment, int aStackTop,
                      LispObject* (*func)(LispObject* f1, LispObject* f2,LispEnvironment& aEnvironment,int aPrecision),
@@ -91,6 +137,13 @@ void LispDumpBigNumberDebugInfo(LispEnvironment& aEnvironment, int aStackTop)
 
 void LispMultiply(LispEnvironment& aEnvironment, int aStackTop)
 {
+      long a, b, c;
+      if (GetSmallIntegers(a, b, aEnvironment, aStackTop) && SmallMultiply(a, b, c))
+      {
+        RESULT = new LispNumber(c);
+        return;
+      }
+
       RefPtr<BigNumber> x;
       RefPtr<BigNumber> y;
       GetNumber(x,aEnvironment, aStackTop, 1);
@@ -116,12 +169,21 @@ void LispGcd(LispEnvironment& aEnvironment, int aStackTop)
 /// converted to BigNumber. If called with two arguments (binary plus),
 /// both argument are converted to a BigNumber, and these are added
 /// together at the current precision. The sum is returned.
+/// Small integers are added directly, without creating a BigNumber,
+/// unless the sum overflows.
 /// \sa GetNumber(), BigNumber::Add()
 void LispAdd(LispEnvironment& aEnvironment, int aStackTop)
 {
     int length = InternalListLength(ARGUMENT(0));
+    long a, b, c;
     if (length == 2)
     {
+      if (ARGUMENT(1)->SmallInteger(a))
+      {
+        RESULT = new LispNumber(a);
+        return;
+      }
+
       RefPtr<BigNumber> x;
       GetNumber(x,aEnvironment, aStackTop, 1);
       RESULT = (new LispNumber(x.ptr()));
@@ -129,6 +191,12 @@ void LispAdd(LispEnvironment& aEnvironment, int aStackTop)
     }
     else
     {
+      if (GetSmallIntegers(a, b, aEnvironment, aStackTop) && SmallAdd(a, b, c))
+      {
+        RESULT = new LispNumber(c);
+        return;
+      }
+
       RefPtr<BigNumber> x;
       RefPtr<BigNumber> y;
       GetNumber(x,aEnvironment, aStackTop, 1);
@@ -144,8 +212,15 @@ void LispAdd(LispEnvironment& aEnvironment, int aStackTop)
 void LispSubtract(LispEnvironment& aEnvironment, int aStackTop)
 {
     int length = InternalListLength(ARGUMENT(0));
+    long a, b, c;
     if (length == 2)
     {
+      if (ARGUMENT(1)->SmallInteger(a) && SmallSubtract(0, a, c))
+      {
+        RESULT = new LispNumber(c);
+        return;
+      }
+
       RefPtr<BigNumber> x;
       GetNumber(x,aEnvironment, aStackTop, 1);
       BigNumber *z = new BigNumber(*x/*aEnvironment.BinaryPrecision()*/);
@@ -155,6 +230,12 @@ void LispSubtract(LispEnvironment& aEnvironment, int aStackTop)
     }
     else
     {
+      if (GetSmallIntegers(a, b, aEnvironment, aStackTop) && SmallSubtract(a, b, c))
+      {
+        RESULT = new LispNumber(c);
+        return;
+      }
+
       RefPtr<BigNumber> x;
       RefPtr<BigNumber> y;
       GetNumber(x,aEnvironment, aStackTop, 1);
@@ -6,14 +6,35 @@
 #include "yacas/patternclass.h"
 #include "yacas/substitute.h"
 
+#include <algorithm>
 #include <memory>
+#include <utility>
 
 #define InternalEval aEnvironment.iEvaluator->Eval
 
+bool BranchingUserFunction::BranchRuleBase::MayMatch(const unsigned* aKinds,
+                                                     const LispString* const* aSymbols,
+                                                     std::size_t aCount) const
+{
+    const std::size_t n = std::min(aCount, iFilters.size());
+    for (std::size_t i = 0; i < n; ++i)
+        if (!iFilters[i].Accepts(aKinds[i], aSymbols[i]))
+            return false;
+    return true;
+}
+
+std::vector<PatternKey> BranchingUserFunction::BranchRuleBase::Keys(std::size_t aArity) const
+{
+    return std::vector<PatternKey>(aArity);
+}
+
 bool BranchingUserFunction::BranchRule::Matches(LispEnvironment& aEnvironment, LispPtr* aArguments)
 {
     LispPtr pred;
-    InternalEval(aEnvironment, pred, iPredicate);
+    if (iCompiledPredicate && LispClosure::Enabled(aEnvironment))
+        iCompiledPredicate->Evaluate(aEnvironment, pred);
+    else
+        InternalEval(aEnvironment, pred, iPredicate);
     return IsTrue(aEnvironment,pred);
 }
 int BranchingUserFunction::BranchRule::Precedence() const
@@ -24,11 +45,31 @@ LispPtr& BranchingUserFunction::BranchRule::Body()
 {
     return iBody;
 }
+void BranchingUserFunction::BranchRule::Freeze(int aPrecision)
+{
+    if (!!iPredicate)
+        iPredicate->Freeze(aPrecision);
+    iBody->Freeze(aPrecision);
+}
+BranchingUserFunction::BranchRuleBase* BranchingUserFunction::BranchRule::Clone() const
+{
+    return new BranchRule(*this);
+}
+void BranchingUserFunction::BranchRule::Compile(const std::vector<const LispString*>& aParameters)
+{
+    if (!!iPredicate)
+        iCompiledPredicate = LispClosure::Compile(iPredicate, aParameters);
+    iCompiledBody = LispClosure::Compile(iBody, aParameters);
+}
 
  bool BranchingUserFunction::BranchRuleTruePredicate::Matches(LispEnvironment& aEnvironment, LispPtr* aArguments)
 {
     return true;
 }
+BranchingUserFunction::BranchRuleBase* BranchingUserFunction::BranchRuleTruePredicate::Clone() const
+{
+    return new BranchRuleTruePredicate(*this);
+}
 
 bool BranchingUserFunction::BranchPattern::Matches(LispEnvironment& aEnvironment, LispPtr* aArguments)
 {
@@ -42,10 +83,67 @@ LispPtr& BranchingUserFunction::BranchPattern::Body()
 {
     return iBody;
 }
+std::vector<PatternKey> BranchingUserFunction::BranchPattern::Keys(std::size_t aArity) const
+{
+    // the pattern decides for itself about another number of arguments
+    if (iPatternClass->Filters().size() != aArity)
+        return BranchRuleBase::Keys(aArity);
 
+    return iPatternClass->Keys();
+}
+void BranchingUserFunction::BranchPattern::Freeze(int aPrecision)
+{
+    iPredicate->Freeze(aPrecision);
+    iBody->Freeze(aPrecision);
+}
+BranchingUserFunction::BranchRuleBase* BranchingUserFunction::BranchPattern::Clone() const
+{
+    // the PatternClass is shared, it is owned by iPredicate
+    LispPtr predicate(iPredicate);
+    LispPtr body(iBody);
+    BranchPattern* rule = new BranchPattern(iPrecedence, predicate, body);
+    rule->iCompiledBody = iCompiledBody;
+    return rule;
+}
+void BranchingUserFunction::BranchPattern::Compile(const std::vector<const LispString*>& aParameters)
+{
+    std::vector<const LispString*> slots(aParameters);
+    const std::vector<const LispString*>& variables = iPatternClass->Variables();
+    slots.insert(slots.end(), variables.begin(), variables.end());
+    iCompiledBody = LispClosure::Compile(iBody, slots);
+}
+
+
+const std::size_t BranchingUserFunction::MAX_FILTERED_ARGUMENTS;
+const std::size_t BranchingUserFunction::MIN_TREE_RULES;
+const std::uint64_t BranchingUserFunction::ORDER_GAP;
+
+namespace {
+    // The rules found in the tree, on the scratch stack of the
+    // environment, which the calls made while trying them use as well.
+    class Candidates {
+    public:
+        explicit Candidates(LispEnvironment& aEnvironment):
+            iStack(aEnvironment.iRuleCandidates), iBase(iStack.size())
+        {
+        }
+
+        ~Candidates()
+        {
+            iStack.resize(iBase);
+        }
+
+        std::size_t Begin() const { return iBase; }
+        std::size_t operator[](std::size_t aIndex) const { return iStack[aIndex]; }
+
+    private:
+        std::vector<std::size_t>& iStack;
+        std::size_t iBase;
+    };
+}
 
 BranchingUserFunction::BranchingUserFunction(LispPtr& aParameters)
-  : iParameters(),iRules(),iParamList(aParameters)
+  : iParameters(),iRules(),iGeneration(0),iParamList(aParameters)
 {
   for (LispIterator iter(aParameters); iter.getObj(); ++iter)
   {
@@ -57,6 +155,22 @@ BranchingUserFunction::BranchingUserFunction(LispPtr& aParameters)
   }
 }
 
+BranchingUserFunction::BranchingUserFunction(const BranchingUserFunction& aOther)
+  : LispArityUserFunction(aOther),
+    iParameters(aOther.iParameters),
+    iRules(),
+    iGeneration(0),
+    iParamList(aOther.iParamList),
+    iMemo(aOther.iMemo ? std::make_shared<LispMemoTable>(aOther.iMemo->Limit()) : nullptr)
+{
+    iRules.reserve(aOther.iRules.size());
+    for (const BranchRuleBase* p: aOther.iRules) {
+        iRules.push_back(p->Clone());
+        iRules.back()->iOrder = p->iOrder;
+    }
+    iAdded = iRules;
+}
+
 BranchingUserFunction::~BranchingUserFunction()
 {
     for (BranchRuleBase* p: iRules)
@@ -100,58 +214,212 @@ void BranchingUserFunction::Evaluate(LispPtr& aResult,LispEnvironment& aEnvironm
             TraceShowArg(aEnvironment, *++iter, arguments[i]);
     }
 
+    EvaluateRules(aResult, aEnvironment, aArguments, arguments.get());
+}
+
+void BranchingUserFunction::EvaluateRules(LispPtr& aResult, LispEnvironment& aEnvironment,
+                                          LispPtr& aArguments, LispPtr* aEvaluated) const
+{
+    if (!iMemo) {
+        EvaluateCalls(aResult, aEnvironment, aArguments, aEvaluated);
+        return;
+    }
+
+    const std::shared_ptr<LispMemoTable> memo(iMemo);
+
+    // the key keeps the arguments, which the result may be built of
+    LispMemoTable::Key key = memo->MakeKey(aEvaluated, Arity(), aEnvironment.Precision());
+
+    if (memo->Find(key, aResult)) {
+        if (Traced()) {
+            LispPtr tr(LispSubList::New(aArguments));
+            TraceShowLeave(aEnvironment, aResult, tr);
+            tr = nullptr;
+        }
+        return;
+    }
+
+    EvaluateCalls(aResult, aEnvironment, aArguments, aEvaluated);
+    memo->Insert(std::move(key), aResult);
+}
+
+void BranchingUserFunction::EvaluateCalls(LispPtr& aResult, LispEnvironment& aEnvironment,
+                                          LispPtr& aArguments, LispPtr* aEvaluated) const
+{
+    LispClosure::TailCall call;
+
+    if (!EvaluateRule(aResult, aEnvironment, aArguments, aEvaluated, call))
+        return;
+
+    // make the calls in tail position here, one after the other,
+    // instead of from within the bodies
+    LispPtr arguments;
+    std::vector<LispPtr> evaluated;
+
+    do {
+        const BranchingUserFunction* function = call.iFunction;
+        arguments = call.iList;
+        evaluated.swap(call.iArguments);
+        call = LispClosure::TailCall();
+        if (function->Memoized()) {
+            function->EvaluateRules(aResult, aEnvironment, arguments, evaluated.data());
+            return;
+        }
+        if (!function->EvaluateRule(aResult, aEnvironment, arguments, evaluated.data(), call))
+            return;
+        aEnvironment.Safepoint();
+    } while (true);
+}
+
+bool BranchingUserFunction::EvaluateRule(LispPtr& aResult, LispEnvironment& aEnvironment,
+                                         LispPtr& aArguments, LispPtr* aEvaluated,
+                                         LispClosure::TailCall& aCall) const
+{
     // declare a new local stack.
     LispLocalFrame frame(aEnvironment, Fenced());
 
+    if (BranchRuleBase* rule = MatchRule(aEnvironment, aEvaluated)) {
+        if (LispClosure::Enabled(aEnvironment) && rule->CompiledBody()) {
+            if (Traced())
+                rule->CompiledBody()->Evaluate(aEnvironment, aResult);
+            else if (rule->CompiledBody()->EvaluateTail(aEnvironment, aResult, aCall))
+                return true;
+        } else {
+            InternalEval(aEnvironment, aResult, rule->Body());
+        }
+    } else {
+        Unevaluated(aResult, aArguments, aEvaluated);
+    }
+
+    if (Traced()) {
+        LispPtr tr(LispSubList::New(aArguments));
+        TraceShowLeave(aEnvironment, aResult, tr);
+        tr = nullptr;
+    }
+
+    return false;
+}
+
+BranchingUserFunction::BranchRuleBase* BranchingUserFunction::MatchRule(LispEnvironment& aEnvironment,
+                                                                       LispPtr* aEvaluated) const
+{
+    const int arity = Arity();
+
     // define the local variables.
-    for (i = 0; i < arity; i++) {
+    for (int i = 0; i < arity; i++) {
         const LispString* variable = iParameters[i].iParameter;
         // set the variable to the new value
-        aEnvironment.NewLocal(variable, arguments[i]);
+        aEnvironment.NewLocal(variable, aEvaluated[i]);
     }
 
-    // walk the rules database, returning the evaluated result if the
-    // predicate is true.
-    const std::size_t nrRules = iRules.size();
+    // the kinds of the arguments, worked out when the first rule with
+    // filters is tried
+    unsigned kinds[MAX_FILTERED_ARGUMENTS];
+    const LispString* symbols[MAX_FILTERED_ARGUMENTS];
+    std::size_t nrKinds = 0;
+    bool kindsKnown = false;
+
+    const auto mayMatch = [&](const BranchRuleBase* aRule) {
+        if (!aRule->Filtered())
+            return true;
+
+        if (!kindsKnown) {
+            nrKinds = std::min(static_cast<std::size_t>(arity), MAX_FILTERED_ARGUMENTS);
+            for (std::size_t j = 0; j < nrKinds; ++j)
+                kinds[j] = ArgumentFilter::Kind(aEvaluated[j], symbols[j]);
+            kindsKnown = true;
+        }
+
+        return aRule->MayMatch(kinds, symbols, nrKinds);
+    };
+
     UserStackInformation &st = aEnvironment.iEvaluator->StackInformation();
-    for (std::size_t i = 0; i < nrRules; i++) {
+
+    // a predicate may add rules, which moves the ones after them
+    unsigned generation = iGeneration;
+
+    // the rule to go on with one by one
+    std::size_t i = 0;
+
+    if (const PatternTree* tree = Tree()) {
+        Candidates candidates(aEnvironment);
+        std::vector<std::size_t>& found = aEnvironment.iRuleCandidates;
+        tree->Find(aEvaluated, arity, found, aEnvironment.iPatternTerms);
+        const std::size_t end = found.size();
+
+        // try them in the order of iRules
+        std::sort(found.begin() + candidates.Begin(), found.begin() + end,
+                  [this](std::size_t a, std::size_t b) {
+                      return iAdded[a]->iOrder < iAdded[b]->iOrder;
+                  });
+
+        for (std::size_t c = candidates.Begin(); c < end; ++c) {
+            BranchRuleBase* thisRule = iAdded[candidates[c]];
+
+            if (!mayMatch(thisRule))
+                continue;
+
+            st.iRulePrecedence = thisRule->Precedence();
+            if (thisRule->Matches(aEnvironment, aEvaluated)) {
+                st.iSide = 1;
+                return thisRule;
+            }
+
+            // If rules got inserted, the candidates are off: go on
+            // with the rules after this one
+            if (iGeneration != generation) {
+                generation = iGeneration;
+                i = std::find(iRules.begin(), iRules.end(), thisRule) - iRules.begin() + 1;
+                break;
+            }
+        }
+
+        if (i == 0)
+            return nullptr;
+    }
+
+    // walk the rules database, returning the first rule whose
+    // predicate is true.
+    for (; i < iRules.size(); i++) {
         BranchRuleBase* thisRule = iRules[i];
         assert(thisRule);
 
+        if (!mayMatch(thisRule))
+            continue;
+
         st.iRulePrecedence = thisRule->Precedence();
-        bool matches = thisRule->Matches(aEnvironment, arguments.get());
-        if (matches) {
+        if (thisRule->Matches(aEnvironment, aEvaluated)) {
             st.iSide = 1;
-            InternalEval(aEnvironment, aResult, thisRule->Body());
-            goto FINISH;
+            return thisRule;
         }
 
-        // If rules got inserted, walk back
-        while (thisRule != iRules[i] && i > 0)
-            i--;
+        // If rules got inserted, find this one again
+        if (iGeneration != generation) {
+            generation = iGeneration;
+            i = std::find(iRules.begin(), iRules.end(), thisRule) - iRules.begin();
+        }
     }
 
-    // No predicate was true: return a new expression with the evaluated
-    // arguments.
+    return nullptr;
+}
 
-    {
-        LispPtr full(aArguments->Copy());
-        if (arity == 0) {
-            full->Nixed() = nullptr;
-        } else {
-            full->Nixed() = arguments[0];
-            for (i = 0; i < arity - 1; i++)
-                arguments[i]->Nixed() = arguments[i + 1];
-        }
-        aResult = LispSubList::New(full);
-    }
+void BranchingUserFunction::Unevaluated(LispPtr& aResult, LispPtr& aArguments, LispPtr* aEvaluated) const
+{
+    const int arity = Arity();
 
-FINISH:
-    if (Traced()) {
-        LispPtr tr(LispSubList::New(aArguments));
-        TraceShowLeave(aEnvironment, aResult, tr);
-        tr = nullptr;
+    // No predicate was true: return a new expression with the evaluated
+    // arguments.
+    LispPtr full(aArguments->Copy());
+    if (arity == 0) {
+        full->Nixed() = nullptr;
+    } else {
+        for (int i = 0; i < arity; i++)
+            Detach(aEvaluated[i]);
+        full->Nixed() = aEvaluated[0];
+        for (int i = 0; i < arity - 1; i++)
+            aEvaluated[i]->Nixed() = aEvaluated[i + 1];
     }
+    aResult = LispSubList::New(full);
 }
 
 void BranchingUserFunction::HoldArgument(const LispString * aVariable)
@@ -164,6 +432,31 @@ void BranchingUserFunction::HoldArgument(const LispString * aVariable)
     }
 }
 
+std::vector<const LispString*> BranchingUserFunction::ParameterNames() const
+{
+    std::vector<const LispString*> names;
+    names.reserve(iParameters.size());
+    for (const BranchParameter& p: iParameters)
+        names.push_back(p.iParameter);
+    return names;
+}
+
+const PatternTree* BranchingUserFunction::Tree() const
+{
+    if (iRules.size() < MIN_TREE_RULES)
+        return nullptr;
+
+    if (!iTree) {
+        std::unique_ptr<PatternTree> tree(new PatternTree);
+        const std::size_t nrRules = iAdded.size();
+        for (std::size_t i = 0; i < nrRules; ++i)
+            tree->Insert(iAdded[i]->Keys(Arity()), i);
+        iTree = std::move(tree);
+    }
+
+    return iTree.get();
+}
+
 int BranchingUserFunction::Arity() const
 {
     return iParameters.size();
@@ -183,6 +476,7 @@ void BranchingUserFunction::DeclareRule(int aPrecedence, LispPtr& aPredicate,
     if (!newRule)
         throw LispErrCreatingRule();
 
+    newRule->Compile(ParameterNames());
     InsertRule(aPrecedence,newRule);
 }
 
@@ -194,6 +488,7 @@ void BranchingUserFunction::DeclareRule(int aPrecedence, LispPtr& aBody)
     if (!newRule)
         throw LispErrCreatingRule();
 
+    newRule->Compile(ParameterNames());
     InsertRule(aPrecedence,newRule);
 }
 
@@ -206,6 +501,7 @@ void BranchingUserFunction::DeclarePattern(int aPrecedence, LispPtr& aPredicate,
     if (!newRule)
         throw LispErrCreatingRule();
 
+    newRule->Compile(ParameterNames());
     InsertRule(aPrecedence,newRule);
 }
 
@@ -258,6 +554,36 @@ void BranchingUserFunction::InsertRule(int aPrecedence,BranchRuleBase* newRule)
     CONTINUE:
     // Insert it
     iRules.insert(iRules.begin() + mid, newRule);
+    NumberRule(mid);
+    iAdded.push_back(newRule);
+    ++iGeneration;
+
+    if (iTree)
+        iTree->Insert(newRule->Keys(Arity()), iAdded.size() - 1);
+}
+
+void BranchingUserFunction::NumberRule(std::size_t aIndex)
+{
+    const std::size_t nrRules = iRules.size();
+
+    // the rules around the new one are numbered again, evenly in the
+    // room between their neighbours, in a range which is widened until
+    // the room is at least its length per rule
+    for (std::size_t width = 0;; width = 2 * width + 1) {
+        const std::size_t first = aIndex > width ? aIndex - width : 0;
+        const std::size_t last = std::min(aIndex + width, nrRules - 1);
+        const std::uint64_t count = last - first + 1;
+
+        const std::uint64_t low = first > 0 ? iRules[first - 1]->iOrder : 0;
+        const std::uint64_t high = last + 1 < nrRules ? iRules[last + 1]->iOrder : low + (count + 1) * ORDER_GAP;
+        const std::uint64_t step = (high - low) / (count + 1);
+
+        if (step > count || (first == 0 && last + 1 == nrRules)) {
+            for (std::size_t i = first; i <= last; ++i)
+                iRules[i]->iOrder = low + (i - first + 1) * step;
+            return;
+        }
+    }
 }
 
 const LispPtr& BranchingUserFunction::ArgList() const
@@ -265,11 +591,52 @@ const LispPtr& BranchingUserFunction::ArgList() const
     return iParamList;
 }
 
+void BranchingUserFunction::Freeze(int aPrecision)
+{
+    if (!!iParamList)
+        iParamList->Freeze(aPrecision);
+
+    for (BranchRuleBase* p: iRules)
+        p->Freeze(aPrecision);
+
+    // frozen functions are shared, the tree has to be there already
+    Tree();
+}
+
+LispArityUserFunction* BranchingUserFunction::Clone() const
+{
+    return new BranchingUserFunction(*this);
+}
+
+void BranchingUserFunction::Memoize(std::size_t aLimit)
+{
+    if (iMemo)
+        iMemo->SetLimit(aLimit);
+    else
+        iMemo = std::make_shared<LispMemoTable>(aLimit);
+}
+
+void BranchingUserFunction::UnMemoize()
+{
+    iMemo = nullptr;
+}
+
+void BranchingUserFunction::Forget()
+{
+    if (iMemo)
+        iMemo->Clear();
+}
+
 ListedBranchingUserFunction::ListedBranchingUserFunction(LispPtr& aParameters)
     : BranchingUserFunction(aParameters)
 {
 }
 
+LispArityUserFunction* ListedBranchingUserFunction::Clone() const
+{
+    return new ListedBranchingUserFunction(*this);
+}
+
 int ListedBranchingUserFunction::IsArity(int aArity) const
 {
     // nr arguments handled is bound by a minimum: the number of arguments
@@ -321,6 +688,11 @@ MacroUserFunction::MacroUserFunction(LispPtr& aParameters)
   UnFence();
 }
 
+LispArityUserFunction* MacroUserFunction::Clone() const
+{
+    return new MacroUserFunction(*this);
+}
+
 void MacroUserFunction::Evaluate(LispPtr& aResult,LispEnvironment& aEnvironment,
               LispPtr& aArguments) const
 {
@@ -365,54 +737,17 @@ void MacroUserFunction::Evaluate(LispPtr& aResult,LispEnvironment& aEnvironment,
         // declare a new local stack.
         LispLocalFrame frame(aEnvironment, false);
 
-        // define the local variables.
-        for (i = 0; i < arity; i++) {
-            const LispString* variable = iParameters[i].iParameter;
-            // set the variable to the new value
-            aEnvironment.NewLocal(variable, arguments[i]);
-        }
-
-        // walk the rules database, returning the evaluated result if the
-        // predicate is true.
-        const std::size_t nrRules = iRules.size();
-        UserStackInformation &st = aEnvironment.iEvaluator->StackInformation();
-        for (std::size_t i = 0; i < nrRules; i++) {
-            BranchRuleBase* thisRule = iRules[i];
-            assert(thisRule);
-
-            st.iRulePrecedence = thisRule->Precedence();
-            const bool matches = thisRule->Matches(aEnvironment, arguments.get());
-            if (matches) {
-                st.iSide = 1;
-
-                BackQuoteBehaviour behaviour(aEnvironment);
-                InternalSubstitute(substedBody, thisRule->Body(), behaviour);
-                break;
-            }
-
-            // If rules got inserted, walk back
-            while (thisRule != iRules[i] && i > 0)
-                i--;
+        if (BranchRuleBase* rule = MatchRule(aEnvironment, arguments.get())) {
+            BackQuoteBehaviour behaviour(aEnvironment);
+            InternalSubstitute(substedBody, rule->Body(), behaviour);
         }
     }
 
-    if (!!substedBody) {
+    if (!!substedBody)
         InternalEval(aEnvironment, aResult, substedBody);
-    } else
-        // No predicate was true: return a new expression with the evaluated
-        // arguments.
-    {
-        LispPtr full(aArguments->Copy());
-        if (arity == 0) {
-            full->Nixed() = nullptr;
-        } else {
-            full->Nixed() = arguments[0];
-            for (i = 0; i < arity - 1; i++) {
-                arguments[i]->Nixed() = arguments[i + 1];
-            }
-        }
-        aResult = LispSubList::New(full);
-    }
+    else
+        Unevaluated(aResult, aArguments, arguments.get());
+
     if (Traced()) {
         LispPtr tr(LispSubList::New(aArguments));
         TraceShowLeave(aEnvironment, aResult, tr);
@@ -425,6 +760,11 @@ ListedMacroUserFunction::ListedMacroUserFunction(LispPtr& aParameters)
 {
 }
 
+LispArityUserFunction* ListedMacroUserFunction::Clone() const
+{
+    return new ListedMacroUserFunction(*this);
+}
+
 int ListedMacroUserFunction::IsArity(int aArity) const
 {
     return Arity() <= aArity;
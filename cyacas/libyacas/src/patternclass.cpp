@@ -15,6 +15,12 @@ const char* PatternClass::TypeName() const
     return "\"Pattern\"";
 }
 
+void PatternClass::Freeze(int aPrecision)
+{
+    GenericClass::Freeze(aPrecision);
+    iPatternMatcher->Freeze(aPrecision);
+}
+
 bool PatternClass::Matches(LispEnvironment& aEnvironment,
                                   LispPtr& aArguments)
 {
@@ -28,3 +34,18 @@ bool PatternClass::Matches(LispEnvironment& aEnvironment,
     assert(iPatternMatcher);
     return iPatternMatcher->Matches(aEnvironment, aArguments);
 }
+
+const std::vector<const LispString*>& PatternClass::Variables() const
+{
+    return iPatternMatcher->Variables();
+}
+
+const std::vector<ArgumentFilter>& PatternClass::Filters() const
+{
+    return iPatternMatcher->Filters();
+}
+
+std::vector<PatternKey> PatternClass::Keys() const
+{
+    return iPatternMatcher->Keys();
+}
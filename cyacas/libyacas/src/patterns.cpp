@@ -5,30 +5,103 @@
 #include "yacas/lispeval.h"
 #include "yacas/standard.h"
 
-#include <memory>
+unsigned ArgumentFilter::Kind(LispObject* aExpression, const LispString*& aSymbol)
+{
+    aSymbol = nullptr;
+
+    if (LispPtr* sublist = aExpression->SubList()) {
+        LispObject* head = *sublist;
+        // don't ask a number for its string, it may have to be
+        // converted to decimal
+        if (head && !dynamic_cast<LispNumber*>(head))
+            aSymbol = head->String();
+        return LIST;
+    }
+
+    if (LispNumber* number = dynamic_cast<LispNumber*>(aExpression))
+        return number->IsInt() ? INTEGER : FLOAT;
+
+    if ((aSymbol = aExpression->String()))
+        return ATOM;
+
+    return OTHER;
+}
+
+bool ArgumentFilter::Accepts(LispObject* aExpression) const
+{
+    if (AcceptsAll())
+        return true;
+
+    const LispString* symbol;
+    const unsigned kind = Kind(aExpression, symbol);
+    return Accepts(kind, symbol);
+}
+
+void ArgumentFilter::Restrict(const ArgumentFilter& aOther)
+{
+    iKinds &= aOther.iKinds;
+
+    if (aOther.iSymbol) {
+        if (iSymbol && iSymbol != aOther.iSymbol)
+            iKinds = 0;
+        iSymbol = aOther.iSymbol;
+    }
+}
 
 bool MatchAtom::ArgumentMatches(LispEnvironment& aEnvironment,
                                        LispPtr& aExpression,
                                        LispPtr* arguments) const
 {
-    // If it is a floating point, don't even bother comparing
-    if (!!aExpression)
-      if (aExpression->Number(0))
-        if (!aExpression->Number(0)->IsInt())
-          return false;
+    // Numbers never share the interned string of an atom, and asking
+    // one for its string may convert it to decimal
+    if (dynamic_cast<LispNumber*>(aExpression.ptr()))
+        return false;
 
     return (iString == aExpression->String());
 }
 
+ArgumentFilter MatchAtom::Filter() const
+{
+    return ArgumentFilter(ArgumentFilter::ATOM, iString);
+}
+
+void MatchAtom::AppendKeys(std::vector<PatternKey>& aKeys) const
+{
+    aKeys.emplace_back(PatternKey::ATOM, iString);
+}
+
 
 bool MatchNumber::ArgumentMatches(LispEnvironment& aEnvironment,
                                        LispPtr& aExpression,
                                        LispPtr* arguments) const
 {
-    if (aExpression->Number(aEnvironment.Precision()))
-        return iNumber->Equals(*aExpression->Number(aEnvironment.Precision()));
+    LispNumber* number = dynamic_cast<LispNumber*>(aExpression.ptr());
 
-    return false;
+    if (!number)
+        return false;
+
+    long value;
+    if (iIsSmall && number->SmallInteger(value))
+        return value == iSmall;
+
+    // an integer which isn't small is out of the range of a small one
+    if (iIsSmall && number->IsInt())
+        return false;
+
+    return iNumber->Equals(*number->Number(aEnvironment.Precision()));
+}
+
+ArgumentFilter MatchNumber::Filter() const
+{
+    return ArgumentFilter(ArgumentFilter::NUMBER);
+}
+
+void MatchNumber::AppendKeys(std::vector<PatternKey>& aKeys) const
+{
+    if (iIsSmall)
+        aKeys.emplace_back(PatternKey::INTEGER, nullptr, 0, iSmall);
+    else
+        aKeys.emplace_back(PatternKey::NUMBER);
 }
 
 bool MatchVariable::ArgumentMatches(LispEnvironment& aEnvironment,
@@ -36,7 +109,10 @@ bool MatchVariable::ArgumentMatches(LispEnvironment& aEnvironment,
                                        LispPtr* arguments) const
 {
     if (!arguments[iVarIndex]) {
+        if (!iFilter.Accepts(aExpression))
+            return false;
         arguments[iVarIndex] = aExpression;
+        aEnvironment.iPatternTrail.push_back(&arguments[iVarIndex]);
         return true;
     }
 
@@ -46,6 +122,16 @@ bool MatchVariable::ArgumentMatches(LispEnvironment& aEnvironment,
     return false;
 }
 
+ArgumentFilter MatchVariable::Filter() const
+{
+    return iFilter;
+}
+
+void MatchVariable::Restrict(const ArgumentFilter& aFilter)
+{
+    iFilter.Restrict(aFilter);
+}
+
 bool MatchSubList::ArgumentMatches(LispEnvironment& aEnvironment,
                                           LispPtr& aExpression,
                                           LispPtr* arguments) const
@@ -79,6 +165,285 @@ bool MatchSubList::ArgumentMatches(LispEnvironment& aEnvironment,
   return true;
 }
 
+bool MatchSubList::ArgumentMatches(LispEnvironment& aEnvironment,
+                                   LispPtr& aExpression,
+                                   LispPtr* arguments,
+                                   const MatchContinuation& aNext) const
+{
+    if (!aExpression->SubList())
+        return false;
+
+    LispPtr* elements = aExpression->SubList();
+
+    if (!*elements)
+        throw LispErrInvalidArg();
+
+    return MatchElements(aEnvironment, *elements, 0, arguments, aNext);
+}
+
+bool MatchSubList::MatchElements(LispEnvironment& aEnvironment, LispPtr& aElement,
+                                 std::size_t aIndex, LispPtr* arguments,
+                                 const MatchContinuation& aNext) const
+{
+    if (aIndex == iMatchers.size())
+        return !aElement && aNext();
+
+    if (!aElement)
+        return false;
+
+    const auto next = [&] {
+        return MatchElements(aEnvironment, aElement->Nixed(), aIndex + 1, arguments, aNext);
+    };
+
+    return iMatchers[aIndex]->ArgumentMatches(aEnvironment, aElement, arguments, next);
+}
+
+ArgumentFilter MatchSubList::Filter() const
+{
+    const ArgumentFilter head = iMatchers.empty() ? ArgumentFilter() : iMatchers[0]->Filter();
+
+    // an atom at the head is the symbol of the list
+    if (head.iKinds == ArgumentFilter::ATOM && head.iSymbol)
+        return ArgumentFilter(ArgumentFilter::LIST, head.iSymbol);
+
+    return ArgumentFilter(ArgumentFilter::LIST);
+}
+
+void MatchSubList::AppendKeys(std::vector<PatternKey>& aKeys) const
+{
+    aKeys.emplace_back(PatternKey::LIST, nullptr, iMatchers.size());
+
+    for (const YacasParamMatcherBase* m: iMatchers)
+        m->AppendKeys(aKeys);
+}
+
+namespace {
+    // Whether aExpression is a call to aFunction with two operands or
+    // more.
+    bool IsCallTo(LispObject* aExpression, const LispString* aFunction)
+    {
+        const LispString* symbol;
+        if (ArgumentFilter::Kind(aExpression, symbol) != ArgumentFilter::LIST || symbol != aFunction)
+            return false;
+
+        LispObject* head = *aExpression->SubList();
+        return head->Nixed() && head->Nixed()->Nixed();
+    }
+
+    // Append the operands of the call aCall to aOperands, and the ones
+    // of the calls to the same function among them if aFlatten.
+    void AppendOperands(LispObject* aCall, bool aFlatten, std::vector<LispObject*>& aOperands)
+    {
+        LispObject* head = *aCall->SubList();
+
+        for (LispObject* p = head->Nixed(); p; p = p->Nixed()) {
+            if (aFlatten && IsCallTo(p, head->String()))
+                AppendOperands(p, aFlatten, aOperands);
+            else
+                aOperands.push_back(p);
+        }
+    }
+
+    // Undo the bindings made since the trail had aSize entries.
+    void Unbind(std::vector<LispPtr*>& aTrail, std::size_t aSize)
+    {
+        while (aTrail.size() > aSize) {
+            *aTrail.back() = nullptr;
+            aTrail.pop_back();
+        }
+    }
+
+    // The operands being matched, on the scratch stack of the
+    // environment.
+    class Terms {
+    public:
+        explicit Terms(LispEnvironment& aEnvironment):
+            iStack(aEnvironment.iPatternTerms), iBase(iStack.size())
+        {
+        }
+
+        ~Terms()
+        {
+            iStack.resize(iBase);
+        }
+
+        std::size_t Base() const { return iBase; }
+        std::size_t Count() const { return iStack.size() - iBase; }
+
+    private:
+        std::vector<LispObject*>& iStack;
+        std::size_t iBase;
+    };
+}
+
+MatchACList::MatchACList(const LispString* aFunction, bool aAssociative, bool aCommutative,
+                         std::vector<const YacasParamMatcherBase*>&& aOperands):
+    iFunction(aFunction),
+    iAssociative(aAssociative),
+    iCommutative(aCommutative),
+    iOperands(aOperands),
+    iRest(aOperands.size())
+{
+    const std::size_t n = iOperands.size();
+
+    if (iAssociative)
+        for (std::size_t i = n; i > 0 && iRest == n; --i)
+            if (dynamic_cast<const MatchVariable*>(iOperands[i - 1]))
+                iRest = i - 1;
+
+    for (std::size_t i = 0; i < n; ++i)
+        if (i != iRest && !dynamic_cast<const MatchVariable*>(iOperands[i]))
+            iOrder.push_back(i);
+
+    for (std::size_t i = 0; i < n; ++i)
+        if (i != iRest && dynamic_cast<const MatchVariable*>(iOperands[i]))
+            iOrder.push_back(i);
+}
+
+MatchACList::~MatchACList()
+{
+    for (const YacasParamMatcherBase* m: iOperands)
+        delete m;
+}
+
+bool MatchACList::ArgumentMatches(LispEnvironment& aEnvironment,
+                                  LispPtr& aExpression,
+                                  LispPtr* arguments) const
+{
+    const auto done = [] { return true; };
+
+    return ArgumentMatches(aEnvironment, aExpression, arguments, done);
+}
+
+bool MatchACList::ArgumentMatches(LispEnvironment& aEnvironment,
+                                  LispPtr& aExpression,
+                                  LispPtr* arguments,
+                                  const MatchContinuation& aNext) const
+{
+    if (!IsCallTo(aExpression, iFunction))
+        return false;
+
+    Terms terms(aEnvironment);
+    AppendOperands(aExpression, iAssociative, aEnvironment.iPatternTerms);
+
+    const std::size_t n = iOperands.size();
+
+    if (iRest == n ? terms.Count() != n : terms.Count() < n)
+        return false;
+
+    if (iCommutative)
+        return MatchAnyOrder(aEnvironment, terms.Base(), terms.Count(), 0, arguments, aNext);
+
+    return MatchInOrder(aEnvironment, terms.Base(), terms.Count(), 0, arguments, aNext);
+}
+
+ArgumentFilter MatchACList::Filter() const
+{
+    return ArgumentFilter(ArgumentFilter::LIST, iFunction);
+}
+
+bool MatchACList::MatchInOrder(LispEnvironment& aEnvironment, std::size_t aBase,
+                               std::size_t aCount, std::size_t aIndex,
+                               LispPtr* arguments, const MatchContinuation& aNext) const
+{
+    const std::size_t n = iOperands.size();
+
+    if (aIndex == iRest)
+        ++aIndex;
+
+    // the number of operands iRest takes more than one
+    const std::size_t extra = aCount - n;
+
+    if (aIndex >= n)
+        return iRest == n ? aNext() : MatchRest(aEnvironment, aBase, aCount, extra + 1, arguments, aNext);
+
+    std::vector<LispObject*>& terms = aEnvironment.iPatternTerms;
+
+    const std::size_t j = aBase + (aIndex < iRest ? aIndex : aIndex + extra);
+    LispObject* t = terms[j];
+    LispPtr term(t);
+
+    const auto next = [&] {
+        terms[j] = nullptr;
+        const bool matches = MatchInOrder(aEnvironment, aBase, aCount, aIndex + 1, arguments, aNext);
+        terms[j] = t;
+        return matches;
+    };
+
+    return iOperands[aIndex]->ArgumentMatches(aEnvironment, term, arguments, next);
+}
+
+bool MatchACList::MatchAnyOrder(LispEnvironment& aEnvironment, std::size_t aBase,
+                                std::size_t aCount, std::size_t aIndex,
+                                LispPtr* arguments, const MatchContinuation& aNext) const
+{
+    if (aIndex == iOrder.size())
+        return iRest == iOperands.size() ? aNext() : MatchRest(aEnvironment, aBase, aCount, aCount - aIndex, arguments, aNext);
+
+    std::vector<LispObject*>& terms = aEnvironment.iPatternTerms;
+    std::vector<LispPtr*>& trail = aEnvironment.iPatternTrail;
+
+    const YacasParamMatcherBase* operand = iOperands[iOrder[aIndex]];
+    const ArgumentFilter filter = operand->Filter();
+
+    for (std::size_t i = aBase; i < aBase + aCount; ++i) {
+        LispObject* t = terms[i];
+
+        // taken already, or can't match
+        if (!t || !filter.Accepts(t))
+            continue;
+
+        const std::size_t bound = trail.size();
+        LispPtr term(t);
+
+        const auto next = [&] {
+            terms[i] = nullptr;
+            const bool matches = MatchAnyOrder(aEnvironment, aBase, aCount, aIndex + 1, arguments, aNext);
+            terms[i] = t;
+            return matches;
+        };
+
+        if (operand->ArgumentMatches(aEnvironment, term, arguments, next))
+            return true;
+
+        Unbind(trail, bound);
+    }
+
+    return false;
+}
+
+bool MatchACList::MatchRest(LispEnvironment& aEnvironment, std::size_t aBase,
+                            std::size_t aCount, std::size_t aLeft,
+                            LispPtr* arguments, const MatchContinuation& aNext) const
+{
+    const std::vector<LispObject*>& terms = aEnvironment.iPatternTerms;
+
+    LispPtr rest;
+
+    for (std::size_t i = aBase; i < aBase + aCount; ++i) {
+        if (!terms[i])
+            continue;
+
+        if (aLeft == 1) {
+            rest = terms[i];
+            break;
+        }
+
+        if (!rest) {
+            rest = terms[i]->Copy();
+            continue;
+        }
+
+        // the operands are applied from the left, as a+b+c is (a+b)+c
+        LispObject* head = LispAtom::New(aEnvironment, *iFunction);
+        head->Nixed() = rest;
+        rest->Nixed() = terms[i]->Copy();
+        rest = LispSubList::New(head);
+    }
+
+    return iOperands[iRest]->ArgumentMatches(aEnvironment, rest, arguments, aNext);
+}
+
 int YacasPatternPredicateBase::LookUp(const LispString * aVariable)
 {
     const std::size_t n = iVariables.size();
@@ -86,7 +451,7 @@ int YacasPatternPredicateBase::LookUp(const LispString * aVariable)
         if (iVariables[i] == aVariable)
             return i;
 
-    aVariable->iReferenceCount += 1;
+    ++aVariable->iReferenceCount;
     iVariables.push_back(aVariable);
     return iVariables.size() - 1;
 }
@@ -147,11 +512,34 @@ const YacasParamMatcherBase* YacasPatternPredicateBase::MakeParamMatcher(LispEnv
 
                         iPredicates.push_back(LispPtr(LispSubList::New(third)));
                     }
-                    return new MatchVariable(index);
+
+                    MatchVariable* matcher = new MatchVariable(index);
+                    iOccurrences.push_back(matcher);
+                    return matcher;
                 }
             }
         }
 
+        const LispString* function;
+        ArgumentFilter::Kind(aPattern, function);
+
+        const bool associative = function && aEnvironment.IsAssociative(function);
+        const bool commutative = function && aEnvironment.IsCommutative(function);
+
+        if ((associative || commutative) && IsCallTo(aPattern, function)) {
+            std::vector<LispObject*> operands;
+            AppendOperands(aPattern, associative, operands);
+
+            std::vector<const YacasParamMatcherBase*> matchers;
+            matchers.reserve(operands.size());
+            for (LispObject* operand: operands) {
+                matchers.push_back(MakeParamMatcher(aEnvironment, operand));
+                assert(matchers.back());
+            }
+            iBacktracks = true;
+            return new MatchACList(function, associative, commutative, std::move(matchers));
+        }
+
         std::vector<const YacasParamMatcherBase*> matchers;
         matchers.reserve(num);
         LispIterator iter(*sublist);
@@ -168,7 +556,8 @@ const YacasParamMatcherBase* YacasPatternPredicateBase::MakeParamMatcher(LispEnv
 YacasPatternPredicateBase::YacasPatternPredicateBase(
     LispEnvironment& aEnvironment,
     LispPtr& aPattern,
-    LispPtr& aPostPredicate)
+    LispPtr& aPostPredicate):
+    iBacktracks(false)
 {
     for (LispIterator iter(aPattern); iter.getObj(); ++iter) {
         const YacasParamMatcherBase* matcher = MakeParamMatcher(aEnvironment, iter.getObj());
@@ -177,12 +566,216 @@ YacasPatternPredicateBase::YacasPatternPredicateBase(
     }
 
     iPredicates.push_back(aPostPredicate);
+
+    FilterPredicates(aEnvironment);
+
+    for (const YacasParamMatcherBase* matcher: iParamMatchers)
+        iFilters.push_back(matcher->Filter());
+
+    for (LispPtr& p: iPredicates)
+        iCompiledPredicates.push_back(LispClosure::Compile(p, iVariables));
+}
+
+const std::vector<const LispString*>& YacasPatternPredicateBase::Variables() const
+{
+    return iVariables;
+}
+
+const std::vector<ArgumentFilter>& YacasPatternPredicateBase::Filters() const
+{
+    return iFilters;
+}
+
+std::vector<PatternKey> YacasPatternPredicateBase::Keys() const
+{
+    std::vector<PatternKey> keys;
+
+    for (const YacasParamMatcherBase* m: iParamMatchers)
+        m->AppendKeys(keys);
+
+    return keys;
+}
+
+namespace {
+    // The core predicates on the type of their argument, and the
+    // kinds of arguments for which they are true.
+    struct TypeTest {
+        const char* iName;
+        unsigned iKinds;
+        // whether the predicate is true for exactly these kinds (and
+        // symbol, for IsList)
+        bool iExact;
+    };
+
+    const TypeTest TYPE_TESTS[] = {
+        {"IsNumber", ArgumentFilter::NUMBER, true},
+        {"IsInteger", ArgumentFilter::INTEGER, true},
+        {"IsAtom", ArgumentFilter::NUMBER | ArgumentFilter::ATOM, true},
+        {"IsString", ArgumentFilter::ATOM, false},
+        {"IsFunction", ArgumentFilter::LIST, true},
+        {"IsList", ArgumentFilter::LIST, true},
+        {"IsGeneric", ArgumentFilter::OTHER, true}
+    };
+
+    // If aPredicate is a type test of one of aVariables, possibly
+    // negated, return the index of the variable and set aFilter to the
+    // arguments for which the test may be true, and aExact to whether
+    // it is true for all of them. Return -1 otherwise.
+    int TypeTestOf(LispEnvironment& aEnvironment,
+                   const std::vector<const LispString*>& aVariables,
+                   LispObject* aPredicate,
+                   ArgumentFilter& aFilter,
+                   bool& aExact)
+    {
+        LispPtr* sublist = aPredicate->SubList();
+        if (!sublist || !*sublist)
+            return -1;
+
+        LispObject* head = *sublist;
+        LispObject* argument = head->Nixed();
+        if (!head->String() || !argument || argument->Nixed())
+            return -1;
+
+        if (head->String() == aEnvironment.HashTable().LookUp("Not")) {
+            ArgumentFilter filter;
+            bool exact;
+            const int index = TypeTestOf(aEnvironment, aVariables, argument, filter, exact);
+
+            // the complement of a set of kinds, but not of a symbol
+            if (index < 0 || !exact || filter.iSymbol)
+                return -1;
+
+            aFilter = ArgumentFilter(ArgumentFilter::ANY & ~filter.iKinds);
+            aExact = true;
+            return index;
+        }
+
+        const LispString* variable = argument->String();
+        if (!variable || dynamic_cast<LispNumber*>(argument))
+            return -1;
+
+        for (const TypeTest& test: TYPE_TESTS) {
+            if (*head->String() != test.iName)
+                continue;
+
+            for (std::size_t i = 0; i < aVariables.size(); ++i) {
+                if (aVariables[i] != variable)
+                    continue;
+
+                aFilter = ArgumentFilter(test.iKinds);
+                if (*head->String() == "IsList")
+                    aFilter.iSymbol = aEnvironment.iList->String();
+                aExact = test.iExact;
+                return i;
+            }
+        }
+
+        return -1;
+    }
+}
+
+void YacasPatternPredicateBase::FilterPredicates(LispEnvironment& aEnvironment)
+{
+    const LispString* and_ = aEnvironment.HashTable().LookUp("And");
+
+    // whichever occurrence of the variable binds it tests it
+    const auto narrow = [this](int aIndex, const ArgumentFilter& aFilter) {
+        for (MatchVariable* occurrence: iOccurrences)
+            if (occurrence->VarIndex() == aIndex)
+                occurrence->Restrict(aFilter);
+    };
+
+    std::vector<LispPtr> predicates;
+
+    for (LispPtr& predicate: iPredicates) {
+        if (!predicate || predicate->String() == aEnvironment.iTrue->String())
+            continue;
+
+        ArgumentFilter filter;
+        bool exact;
+        const int index = TypeTestOf(aEnvironment, iVariables, predicate, filter, exact);
+
+        if (index >= 0) {
+            narrow(index, filter);
+            if (exact)
+                continue;
+        } else if (LispPtr* sublist = predicate->SubList()) {
+            // every operand of And has to be true
+            if (!!*sublist && (*sublist)->String() == and_) {
+                for (LispObject* p = (*sublist)->Nixed(); p; p = p->Nixed()) {
+                    const int index = TypeTestOf(aEnvironment, iVariables, p, filter, exact);
+                    if (index >= 0)
+                        narrow(index, filter);
+                }
+            }
+        }
+
+        predicates.push_back(predicate);
+    }
+
+    iPredicates.swap(predicates);
+}
+
+namespace {
+    // The bindings of the variables of a pattern, on the scratch stack
+    // of the environment. Matching doesn't evaluate anything, so the
+    // stack doesn't grow before they are given back.
+    class Bindings {
+    public:
+        Bindings(LispEnvironment& aEnvironment, std::size_t aCount):
+            iStack(aEnvironment.iPatternBindings), iBase(iStack.size()),
+            iTrail(aEnvironment.iPatternTrail), iTrailBase(iTrail.size())
+        {
+            iStack.resize(iBase + aCount);
+        }
+
+        ~Bindings()
+        {
+            iStack.resize(iBase);
+            iTrail.resize(iTrailBase);
+        }
+
+        LispPtr* Get() { return iStack.data() + iBase; }
+
+    private:
+        std::vector<LispPtr>& iStack;
+        std::size_t iBase;
+        std::vector<LispPtr*>& iTrail;
+        std::size_t iTrailBase;
+    };
+
+    // Drops the local variables declared since it was constructed,
+    // unless Keep() is called.
+    class LocalsMark {
+    public:
+        explicit LocalsMark(LispEnvironment& aEnvironment):
+            iEnvironment(aEnvironment), iSize(aEnvironment.NrLocals()), iKept(false)
+        {
+        }
+
+        ~LocalsMark()
+        {
+            if (!iKept)
+                iEnvironment.PopLocals(iSize);
+        }
+
+        void Keep() { iKept = true; }
+
+    private:
+        LispEnvironment& iEnvironment;
+        std::size_t iSize;
+        bool iKept;
+    };
 }
 
 bool YacasPatternPredicateBase::Matches(LispEnvironment& aEnvironment,
                                               LispPtr& aArguments)
 {
-    std::unique_ptr<LispPtr[]> arguments(iVariables.empty() ? nullptr : new LispPtr[iVariables.size()]);
+    Bindings bindings(aEnvironment, iVariables.size());
+    LispPtr* arguments = bindings.Get();
+
+    if (iBacktracks)
+        return MatchParameterList(aEnvironment, aArguments, 0, arguments) && Bind(aEnvironment, arguments);
 
     LispIterator iter(aArguments);
     const std::size_t n = iParamMatchers.size();
@@ -192,28 +785,14 @@ bool YacasPatternPredicateBase::Matches(LispEnvironment& aEnvironment,
         if (!iter.getObj())
             return false;
         
-        if (!iParamMatchers[i]->ArgumentMatches(aEnvironment, *iter, arguments.get()))
+        if (!iParamMatchers[i]->ArgumentMatches(aEnvironment, *iter, arguments))
             return false;
     }
     
     if (iter.getObj())
         return false;
 
-    {
-        // set the local variables.
-        LispLocalFrame frame(aEnvironment,false);
-
-        SetPatternVariables(aEnvironment, arguments.get());
-
-        // do the predicates
-        if (!CheckPredicates(aEnvironment))
-            return false;
-    }
-
-    // set the local variables for sure now
-    SetPatternVariables(aEnvironment, arguments.get());
-
-    return true;
+    return Bind(aEnvironment, arguments);
 }
 
 
@@ -222,38 +801,89 @@ bool YacasPatternPredicateBase::Matches(LispEnvironment& aEnvironment,
 bool YacasPatternPredicateBase::Matches(LispEnvironment& aEnvironment,
                                               LispPtr* aArguments)
 {
-    std::unique_ptr<LispPtr[]> arguments(iVariables.empty() ? nullptr : new LispPtr[iVariables.size()]);
+    Bindings bindings(aEnvironment, iVariables.size());
+    LispPtr* arguments = bindings.Get();
+
+    if (iBacktracks)
+        return MatchParameters(aEnvironment, aArguments, 0, arguments) && Bind(aEnvironment, arguments);
 
     const std::size_t n = iParamMatchers.size();
     for (std::size_t i = 0; i < n; ++i)
-        if (!iParamMatchers[i]->ArgumentMatches(aEnvironment,aArguments[i],arguments.get()))
+        if (!iParamMatchers[i]->ArgumentMatches(aEnvironment,aArguments[i],arguments))
             return false;
 
-    {
-        // set the local variables.
-        LispLocalFrame frame(aEnvironment, false);
-        SetPatternVariables(aEnvironment, arguments.get());
+    return Bind(aEnvironment, arguments);
+}
+
+bool YacasPatternPredicateBase::MatchParameters(LispEnvironment& aEnvironment, LispPtr* aArguments,
+                                                std::size_t aIndex, LispPtr* arguments) const
+{
+    if (aIndex == iParamMatchers.size())
+        return true;
+
+    const auto next = [&] {
+        return MatchParameters(aEnvironment, aArguments, aIndex + 1, arguments);
+    };
+
+    return iParamMatchers[aIndex]->ArgumentMatches(aEnvironment, aArguments[aIndex], arguments, next);
+}
+
+bool YacasPatternPredicateBase::MatchParameterList(LispEnvironment& aEnvironment, LispPtr& aArgument,
+                                                   std::size_t aIndex, LispPtr* arguments) const
+{
+    if (aIndex == iParamMatchers.size())
+        return !aArgument;
+
+    if (!aArgument)
+        return false;
+
+    const auto next = [&] {
+        return MatchParameterList(aEnvironment, aArgument->Nixed(), aIndex + 1, arguments);
+    };
+
+    return iParamMatchers[aIndex]->ArgumentMatches(aEnvironment, aArgument, arguments, next);
+}
+
+bool YacasPatternPredicateBase::Bind(LispEnvironment& aEnvironment, LispPtr* arguments)
+{
+    LocalsMark mark(aEnvironment);
+
+    // the predicates see the variables where the body will
+    SetPatternVariables(aEnvironment, arguments);
+
+    if (!iPredicates.empty()) {
+        // whatever the predicates declare is dropped
+        LocalsMark declared(aEnvironment);
 
-        // do the predicates
         if (!CheckPredicates(aEnvironment))
             return false;
     }
 
-    // set the local variables for sure now
-    SetPatternVariables(aEnvironment, arguments.get());
+    mark.Keep();
 
     return true;
 }
 
 
 
+void YacasPatternPredicateBase::Freeze(int aPrecision)
+{
+    for (LispPtr& p: iPredicates)
+        if (!!p)
+            p->Freeze(aPrecision);
+}
+
 bool YacasPatternPredicateBase::CheckPredicates(LispEnvironment& aEnvironment)
 {
     const std::size_t n = iPredicates.size();
+    const bool compiled = LispClosure::Enabled(aEnvironment);
   for (std::size_t i = 0; i < n; ++i)
   {
     LispPtr pred;
-    aEnvironment.iEvaluator->Eval(aEnvironment, pred, iPredicates[i]);
+    if (compiled)
+        iCompiledPredicates[i]->Evaluate(aEnvironment, pred);
+    else
+        aEnvironment.iEvaluator->Eval(aEnvironment, pred, iPredicates[i]);
     if (IsFalse(aEnvironment, pred))
     {
       return false;
@@ -0,0 +1,154 @@
+#include "yacas/patterntree.h"
+
+#include "yacas/lispatom.h"
+
+#include <unordered_map>
+
+struct PatternTree::Node {
+    std::unique_ptr<Node> iAny;
+    /// numbers other than small integers
+    std::unique_ptr<Node> iNumber;
+    std::unordered_map<long, std::unique_ptr<Node>> iIntegers;
+    std::unordered_map<const LispString*, std::unique_ptr<Node>> iAtoms;
+    std::vector<std::pair<std::size_t, std::unique_ptr<Node>>> iLists;
+    /// the rules whose patterns end here
+    std::vector<std::size_t> iRules;
+};
+
+namespace {
+    template <typename K>
+    PatternTree::Node* Edge(std::vector<std::pair<K, std::unique_ptr<PatternTree::Node>>>& aEdges, K aKey)
+    {
+        for (auto& e: aEdges)
+            if (e.first == aKey)
+                return e.second.get();
+
+        aEdges.emplace_back(aKey, std::unique_ptr<PatternTree::Node>(new PatternTree::Node));
+        return aEdges.back().second.get();
+    }
+
+    template <typename K>
+    const PatternTree::Node* Edge(const std::vector<std::pair<K, std::unique_ptr<PatternTree::Node>>>& aEdges, K aKey)
+    {
+        for (const auto& e: aEdges)
+            if (e.first == aKey)
+                return e.second.get();
+
+        return nullptr;
+    }
+
+    template <typename K>
+    const PatternTree::Node* Edge(const std::unordered_map<K, std::unique_ptr<PatternTree::Node>>& aEdges, K aKey)
+    {
+        const auto i = aEdges.find(aKey);
+        return i == aEdges.end() ? nullptr : i->second.get();
+    }
+
+    PatternTree::Node* Child(std::unique_ptr<PatternTree::Node>& aChild)
+    {
+        if (!aChild)
+            aChild.reset(new PatternTree::Node);
+        return aChild.get();
+    }
+}
+
+PatternTree::PatternTree():
+    iRoot(new Node)
+{
+}
+
+PatternTree::~PatternTree() = default;
+
+void PatternTree::Insert(const std::vector<PatternKey>& aKeys, std::size_t aRule)
+{
+    Node* node = iRoot.get();
+
+    for (const PatternKey& key: aKeys) {
+        switch (key.iKind) {
+        case PatternKey::ANY:
+            node = Child(node->iAny);
+            break;
+        case PatternKey::NUMBER:
+            node = Child(node->iNumber);
+            break;
+        case PatternKey::INTEGER:
+            node = Child(node->iIntegers[key.iValue]);
+            break;
+        case PatternKey::ATOM:
+            node = Child(node->iAtoms[key.iSymbol]);
+            break;
+        case PatternKey::LIST:
+            node = Edge(node->iLists, key.iLength);
+            break;
+        }
+    }
+
+    node->iRules.push_back(aRule);
+}
+
+void PatternTree::Find(const LispPtr* aArguments, std::size_t aCount,
+                       std::vector<std::size_t>& aRules,
+                       std::vector<LispObject*>& aTerms) const
+{
+    const std::size_t base = aTerms.size();
+
+    // the expressions still to be looked at, the next one on top
+    for (std::size_t i = aCount; i > 0; --i)
+        aTerms.push_back(aArguments[i - 1]);
+
+    Collect(*iRoot, base, aRules, aTerms);
+
+    aTerms.resize(base);
+}
+
+void PatternTree::Collect(const Node& aNode, std::size_t aBase,
+                          std::vector<std::size_t>& aRules,
+                          std::vector<LispObject*>& aTerms)
+{
+    if (aTerms.size() == aBase) {
+        aRules.insert(aRules.end(), aNode.iRules.begin(), aNode.iRules.end());
+        return;
+    }
+
+    LispObject* term = aTerms.back();
+    aTerms.pop_back();
+
+    if (aNode.iAny)
+        Collect(*aNode.iAny, aBase, aRules, aTerms);
+
+    long value;
+
+    if (LispPtr* list = term->SubList()) {
+        if (!aNode.iLists.empty()) {
+            std::size_t n = 0;
+            for (LispObject* p = *list; p; p = p->Nixed())
+                ++n;
+
+            if (const Node* child = Edge(aNode.iLists, n)) {
+                const std::size_t top = aTerms.size();
+                aTerms.resize(top + n);
+                for (LispObject* p = *list; p; p = p->Nixed())
+                    aTerms[top + --n] = p;
+                Collect(*child, aBase, aRules, aTerms);
+                aTerms.resize(top);
+            }
+        }
+    } else if (term->SmallInteger(value)) {
+        if (aNode.iNumber)
+            Collect(*aNode.iNumber, aBase, aRules, aTerms);
+        if (const Node* child = Edge(aNode.iIntegers, value))
+            Collect(*child, aBase, aRules, aTerms);
+    } else if (LispNumber* number = dynamic_cast<LispNumber*>(term)) {
+        if (aNode.iNumber)
+            Collect(*aNode.iNumber, aBase, aRules, aTerms);
+        // a float may equal an integer, a larger integer can't
+        if (!number->IsInt())
+            for (const auto& e: aNode.iIntegers)
+                Collect(*e.second, aBase, aRules, aTerms);
+    } else if (const LispString* symbol = term->String()) {
+        if (const Node* child = Edge(aNode.iAtoms, symbol))
+            Collect(*child, aBase, aRules, aTerms);
+    }
+
+    aTerms.push_back(term);
+}
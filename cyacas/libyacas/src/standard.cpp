@@ -170,6 +170,21 @@ void InternalFlatCopy(LispPtr& aResult, const LispPtr& aOriginal)
     }
 }
 
+void InternalDeepCopy(LispPtr& aResult, const LispPtr& aOriginal)
+{
+    LispIterator res(aResult);
+
+    for (LispObject* orig = aOriginal; orig; orig = orig->Nixed(), ++res) {
+        if (LispPtr* subList = orig->SubList()) {
+            LispPtr copied;
+            InternalDeepCopy(copied, *subList);
+            (*res) = LispSubList::New(copied);
+        } else {
+            (*res) = orig->Copy();
+        }
+    }
+}
+
 std::size_t InternalListLength(const LispPtr& aOriginal)
 {
     LispConstIterator iter(aOriginal);
@@ -246,6 +261,10 @@ bool InternalStrictTotalOrder(
         LispIterator i2(*l2);
         
         while (i1.getObj() && i2.getObj()) {
+            // shared tails (and hash consed lists) are equal
+            if (i1.getObj() == i2.getObj())
+                return false;
+
             const LispPtr& p1 = *i1;
             const LispPtr& p2 = *i2;
             
@@ -286,48 +305,32 @@ bool InternalEquals(const LispEnvironment& aEnvironment,
     if (!aExpression1.ptr() || !aExpression2.ptr())
         return false;
 
-/*TODO This code would be better, if BigNumber::Equals works*/
+    LispPtr* subList1 = aExpression1->SubList();
+    LispPtr* subList2 = aExpression2->SubList();
 
-    BigNumber *n1 = aExpression1->Number(aEnvironment.Precision());
-    BigNumber *n2 = aExpression2->Number(aEnvironment.Precision());
-    if (!(!n1 && !n2) )
-    {
-        if (n1 == n2)
-        {
-            return true;
-        }
-        if (!n1) return false;
-        if (!n2) return false;
-        if (n1->Equals(*n2)) return true;
-//this should be enabled
+    // A list never equals an atom. Lists are compared first, so that
+    // the numeric values of their elements are only looked at when
+    // the lists could be equal.
+    if (!subList1 != !subList2)
         return false;
-    }
-
-
-    //Pointers to strings should be the same
-    if (aExpression1->String() != aExpression2->String())
-    {
-        return false;
-    }
 
-    // Handle same sublists, or nullptr
-    if (aExpression1->SubList() == aExpression2->SubList())
+    if (subList1)
     {
-        return true;
-    }
-
-    // Now check the sublists
-    if (aExpression1->SubList())
-    {
-        if (!aExpression2->SubList())
-        {
+        // lists with different hashes differ
+        LispSubList* l1 = dynamic_cast<LispSubList*>(aExpression1.ptr());
+        LispSubList* l2 = dynamic_cast<LispSubList*>(aExpression2.ptr());
+        if (l1 && l2 && l1->Hash() != l2->Hash())
             return false;
-        }
-        LispIterator iter1(*aExpression1->SubList());
-        LispIterator iter2(*aExpression2->SubList());
+
+        LispIterator iter1(*subList1);
+        LispIterator iter2(*subList2);
 
         while (iter1.getObj() && iter2.getObj())
         {
+            // shared tails (and hash consed lists) are equal
+            if (iter1.getObj() == iter2.getObj())
+                return true;
+
             // compare two list elements
             if (!InternalEquals(aEnvironment, *iter1, *iter2))
             {
@@ -346,8 +349,29 @@ bool InternalEquals(const LispEnvironment& aEnvironment,
         return true;
     }
 
-    // expressions sublists are not the same!
-    return false;
+    long s1, s2;
+    if (aExpression1->SmallInteger(s1) && aExpression2->SmallInteger(s2))
+        return s1 == s2;
+
+/*TODO This code would be better, if BigNumber::Equals works*/
+
+    BigNumber *n1 = aExpression1->Number(aEnvironment.Precision());
+    BigNumber *n2 = aExpression2->Number(aEnvironment.Precision());
+    if (!(!n1 && !n2) )
+    {
+        if (n1 == n2)
+        {
+            return true;
+        }
+        if (!n1) return false;
+        if (!n2) return false;
+        if (n1->Equals(*n2)) return true;
+//this should be enabled
+        return false;
+    }
+
+    //Pointers to strings should be the same
+    return aExpression1->String() == aExpression2->String();
 }
 
 void DoInternalLoad(LispEnvironment& aEnvironment,LispInput* aInput)
@@ -377,6 +401,9 @@ void DoInternalLoad(LispEnvironment& aEnvironment,LispInput* aInput)
         if (!readIn)
             throw LispErrReadingFile();
 
+        if (LispHashCons* hashCons = aEnvironment.HashCons())
+            hashCons->Intern(readIn, aEnvironment.Precision());
+
         // Check for end of file
         if (readIn->String() == eof)
         {
@@ -553,6 +580,7 @@ void ReturnUnEvaluated(LispPtr& aResult,LispPtr& aArguments,
     {
         LispPtr next;
         aEnvironment.iEvaluator->Eval(aEnvironment, next, *iter);
+        Detach(next);
         full->Nixed() = (next);
         full = (next);
         ++iter;
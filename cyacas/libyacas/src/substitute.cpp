@@ -104,6 +104,8 @@ bool BackQuoteBehaviour::Matches(LispPtr& aResult, LispPtr& aElement)
         InternalSubstitute(aResult, result,*this);
 */
         iEnvironment.iEvaluator->Eval(iEnvironment, aResult, cur);
+        // InternalSubstitute() links the result into a list
+        Detach(aResult);
         return true;
     }
     else
@@ -113,6 +115,7 @@ bool BackQuoteBehaviour::Matches(LispPtr& aResult, LispPtr& aElement)
         LispPtr args(ptr->Nixed());
         LispPtr result;
         iEnvironment.iEvaluator->Eval(iEnvironment, result, cur);
+        Detach(result);
         result->Nixed() = (args);
         LispPtr result2(LispSubList::New(result));
         InternalSubstitute(aResult, result2,*this);
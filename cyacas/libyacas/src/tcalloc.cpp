@@ -0,0 +1,262 @@
+
+#include "yacas/stubs.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+// Thread-caching allocator, see stubs.h.
+//
+// Small blocks are carved from 64KB chunks and recycled through per
+// size class free lists owned by a ThreadCache. Every thread gets its
+// own cache, so allocating and freeing on the owning thread takes no
+// lock at all. A block freed by another thread is pushed onto the
+// owner's remote free stack (a lock-free CAS loop) and moved to the
+// free lists by the owner when it runs out of blocks of some size.
+//
+// When a thread exits its cache, with all its memory, is put on the
+// orphan list and adopted by the next thread started, blocks still in
+// use elsewhere are safely returned to it in the meantime. Chunks are
+// never given back to the system.
+//
+// Blocks larger than MAX_SMALL_SIZE, and blocks allocated by a thread
+// which already destroyed its cache, come from malloc.
+
+namespace {
+    struct ThreadCache;
+
+    // precedes every block; the link of a free block is stored in the
+    // first word of its payload
+    struct Header {
+        ThreadCache* iOwner;    // nullptr for blocks from malloc
+        std::size_t iSize;      // size class, or size of a malloc block
+    };
+
+    const std::size_t GRANULARITY = 16;
+    const std::size_t HEADER_SIZE = GRANULARITY;
+    const std::size_t NR_CLASSES = 64;
+    const std::size_t MAX_SMALL_SIZE = NR_CLASSES * GRANULARITY;
+    const std::size_t CHUNK_SIZE = 64 * 1024;
+
+    static_assert(sizeof(Header) <= HEADER_SIZE, "block header too large");
+
+    inline Header* HeaderOf(void* aBlock)
+    {
+        return reinterpret_cast<Header*>(static_cast<char*>(aBlock) - HEADER_SIZE);
+    }
+
+    inline void* BlockOf(Header* aHeader)
+    {
+        return reinterpret_cast<char*>(aHeader) + HEADER_SIZE;
+    }
+
+    inline Header*& Next(Header* aHeader)
+    {
+        return *static_cast<Header**>(BlockOf(aHeader));
+    }
+
+    inline std::size_t ClassSize(std::size_t aClass)
+    {
+        return (aClass + 1) * GRANULARITY;
+    }
+
+    struct ThreadCache {
+        ThreadCache();
+
+        void* Allocate(std::size_t aClass);
+        void Release(Header* aHeader);
+        void DrainRemote();
+
+        Header* iFree[NR_CLASSES];
+
+        // blocks freed by other threads
+        std::atomic<Header*> iRemote;
+
+        char* iTop;
+        char* iEnd;
+
+        // chunks are linked through their first word
+        char* iChunks;
+
+        ThreadCache* iNextOrphan;
+    };
+
+    ThreadCache::ThreadCache():
+        iRemote(nullptr),
+        iTop(nullptr),
+        iEnd(nullptr),
+        iChunks(nullptr),
+        iNextOrphan(nullptr)
+    {
+        for (std::size_t i = 0; i < NR_CLASSES; ++i)
+            iFree[i] = nullptr;
+    }
+
+    void* ThreadCache::Allocate(std::size_t aClass)
+    {
+        Header* h = iFree[aClass];
+
+        if (!h && iRemote.load(std::memory_order_relaxed)) {
+            DrainRemote();
+            h = iFree[aClass];
+        }
+
+        if (h) {
+            iFree[aClass] = Next(h);
+            return BlockOf(h);
+        }
+
+        const std::size_t total = HEADER_SIZE + ClassSize(aClass);
+
+        if (iTop + total > iEnd) {
+            char* chunk = static_cast<char*>(std::malloc(CHUNK_SIZE));
+            if (!chunk)
+                return nullptr;
+            *reinterpret_cast<char**>(chunk) = iChunks;
+            iChunks = chunk;
+            iTop = chunk + GRANULARITY;
+            iEnd = chunk + CHUNK_SIZE;
+        }
+
+        h = reinterpret_cast<Header*>(iTop);
+        iTop += total;
+
+        h->iOwner = this;
+        h->iSize = aClass;
+
+        return BlockOf(h);
+    }
+
+    void ThreadCache::Release(Header* aHeader)
+    {
+        Next(aHeader) = iFree[aHeader->iSize];
+        iFree[aHeader->iSize] = aHeader;
+    }
+
+    void ThreadCache::DrainRemote()
+    {
+        Header* h = iRemote.exchange(nullptr, std::memory_order_acquire);
+
+        while (h) {
+            Header* next = Next(h);
+            Release(h);
+            h = next;
+        }
+    }
+
+    std::mutex orphans_mutex;
+    ThreadCache* orphans = nullptr;
+
+    // trivially destructible, so that the fast path needs no guard
+    thread_local ThreadCache* cache = nullptr;
+    thread_local bool cache_destroyed = false;
+
+    struct CacheOwner {
+        ~CacheOwner()
+        {
+            cache_destroyed = true;
+
+            if (!cache)
+                return;
+
+            std::lock_guard<std::mutex> lock(orphans_mutex);
+            cache->iNextOrphan = orphans;
+            orphans = cache;
+            cache = nullptr;
+        }
+
+        void Adopt()
+        {
+            std::lock_guard<std::mutex> lock(orphans_mutex);
+            if (orphans) {
+                cache = orphans;
+                orphans = cache->iNextOrphan;
+                cache->iNextOrphan = nullptr;
+            } else {
+                cache = new ThreadCache;
+            }
+        }
+    };
+
+    thread_local CacheOwner cache_owner;
+
+    inline ThreadCache* Cache()
+    {
+        if (!cache && !cache_destroyed)
+            cache_owner.Adopt();
+
+        return cache;
+    }
+
+    void* AllocateLarge(std::size_t aNrBytes)
+    {
+        Header* h = static_cast<Header*>(std::malloc(HEADER_SIZE + aNrBytes));
+        if (!h)
+            return nullptr;
+
+        h->iOwner = nullptr;
+        h->iSize = aNrBytes;
+
+        return BlockOf(h);
+    }
+}
+
+void* PlatTcAlloc(std::size_t aNrBytes)
+{
+    if (aNrBytes <= MAX_SMALL_SIZE)
+        if (ThreadCache* c = Cache())
+            return c->Allocate(aNrBytes ? (aNrBytes - 1) / GRANULARITY : 0);
+
+    return AllocateLarge(aNrBytes);
+}
+
+void PlatTcFree(void* aOrig)
+{
+    if (!aOrig)
+        return;
+
+    Header* h = HeaderOf(aOrig);
+    ThreadCache* owner = h->iOwner;
+
+    if (!owner) {
+        std::free(h);
+    } else if (owner == cache) {
+        owner->Release(h);
+    } else {
+        Header* head = owner->iRemote.load(std::memory_order_relaxed);
+        do {
+            Next(h) = head;
+        } while (!owner->iRemote.compare_exchange_weak(head, h, std::memory_order_release, std::memory_order_relaxed));
+    }
+}
+
+void* PlatTcReAlloc(void* aOrig, std::size_t aNrBytes)
+{
+    if (!aOrig)
+        return PlatTcAlloc(aNrBytes);
+
+    Header* h = HeaderOf(aOrig);
+
+    if (!h->iOwner) {
+        h = static_cast<Header*>(std::realloc(h, HEADER_SIZE + aNrBytes));
+        if (!h)
+            return nullptr;
+        h->iSize = aNrBytes;
+        return BlockOf(h);
+    }
+
+    const std::size_t size = ClassSize(h->iSize);
+
+    if (aNrBytes <= size)
+        return aOrig;
+
+    void* result = PlatTcAlloc(aNrBytes);
+    if (!result)
+        return nullptr;
+
+    std::memcpy(result, aOrig, size);
+    PlatTcFree(aOrig);
+
+    return result;
+}
@@ -7,7 +7,8 @@
   kind##operators[hash.LookUp(#name)] = LispInFixOperator(prec);
 
 DefaultYacasEnvironment::DefaultYacasEnvironment(std::ostream& os)
-  : output(os),
+  : arena(new LispArena),
+    output(os),
     infixprinter(prefixoperators,
                  infixoperators,
                  postfixoperators,
@@ -27,12 +28,58 @@ DefaultYacasEnvironment::DefaultYacasEnvironment(std::ostream& os)
 #undef CORE_KERNEL_FUNCTION
 #undef CORE_KERNEL_FUNCTION_ALIAS
 #undef OPERATOR
+
+    arena->SetLimitHandler([this]() { iEnvironment.RequestSafepoint(); });
+}
+
+DefaultYacasEnvironment::DefaultYacasEnvironment(std::ostream& os, const DefaultYacasEnvironment& aFrozen)
+  : arena(new LispArena),
+    output(os),
+    // copied before iEnvironment is constructed, so that the atoms it
+    // creates are the ones used by aFrozen
+    hash(aFrozen.hash),
+    infixprinter(prefixoperators,
+                 infixoperators,
+                 postfixoperators,
+                 bodiedoperators),
+    iEnvironment(coreCommands,userFunctions,
+                 globals,hash,output,infixprinter,
+                 prefixoperators,infixoperators,
+                 postfixoperators,bodiedoperators,
+                 protected_symbols, &input),
+    input(iEnvironment.iInputStatus)
+{
+    // the core commands (including the ones added by the application)
+    // and the operators are taken over from aFrozen as well
+    iEnvironment.Attach(aFrozen.iEnvironment);
+
+    arena->SetLimitHandler([this]() { iEnvironment.RequestSafepoint(); });
+}
+
+DefaultYacasEnvironment::~DefaultYacasEnvironment()
+{
+    // the arena lives on as long as objects allocated from it do
+    arena->SetLimitHandler(nullptr);
 }
 
 
 CYacas::CYacas(std::ostream& os):
-    environment(os)
+    environment(os),
+    _frozen(false)
+{
+}
+
+CYacas::CYacas(std::ostream& os, const CYacas& aFrozen):
+    environment(os, aFrozen.environment),
+    _frozen(false)
 {
+    assert(aFrozen.IsFrozen());
+}
+
+void CYacas::Freeze()
+{
+    environment.getEnv().Freeze();
+    _frozen = true;
 }
 
 void CYacas::Evaluate(const std::string& aExpression)
@@ -40,6 +87,8 @@ void CYacas::Evaluate(const std::string& aExpression)
     LispEnvironment& env = environment.getEnv();
     int stackTop = env.iStack.size();
 
+    LispArenaScope arenaScope(environment.getArena());
+
     env.iErrorOutput.clear();
     env.iErrorOutput.str("");
 
@@ -49,6 +98,10 @@ void CYacas::Evaluate(const std::string& aExpression)
 
     try
      {
+         // see Freeze()
+         if (_frozen)
+             throw LispErrGeneric("Evaluation in a frozen engine");
+
          LispPtr lispexpr;
 //printf("Input: [%s]\n",aExpression);
          if (env.PrettyReader())
@@ -114,3 +167,20 @@ void CYacas::Evaluate(const std::string& aExpression)
      _result = iResultOutput.str();
      _error = env.iErrorOutput.str();
 }
+
+void CYacas::EvaluateWithTimeout(const std::string& aExpression,
+                                 std::chrono::steady_clock::duration aTimeout)
+{
+    LispEnvironment& env = environment.getEnv();
+
+    env.SetDeadline(std::chrono::steady_clock::now() + aTimeout);
+
+    try {
+        Evaluate(aExpression);
+    } catch (...) {
+        env.ClearDeadline();
+        throw;
+    }
+
+    env.ClearDeadline();
+}
@@ -206,40 +206,25 @@ LispString * LispFactorial(LispChar * int1, LispHashTable& aHashTable,int aPreci
 // this will use the new BigNumber/BigInt/BigFloat scheme
 
 BigNumber::BigNumber(const char* aString,int aBasePrecision,int aBase)
- : iReferenceCount(),iPrecision(0),iType(KInt),iNumber(nullptr)
+ : iReferenceCount(),iPrecision(0),iType(KInt),iNumber(&iStorage),iStorage(aBasePrecision)
 {
-  iNumber = nullptr;
   SetTo(aString, aBasePrecision, aBase);
 }
 BigNumber::BigNumber(const BigNumber& aOther)
- : iReferenceCount(),iPrecision(aOther.GetPrecision()),iType(KInt),iNumber(nullptr)
+ : iReferenceCount(),iPrecision(aOther.GetPrecision()),iType(KInt),iNumber(&iStorage),iStorage(*aOther.iNumber)
 {
-  iNumber = new ANumber(*aOther.iNumber);
   SetIsInteger(aOther.IsInt());
 }
 BigNumber::BigNumber(int aPrecision)
- : iReferenceCount(),iPrecision(aPrecision),iType(KInt),iNumber(nullptr)
+ : iReferenceCount(),iPrecision(aPrecision),iType(KInt),iNumber(&iStorage),iStorage(bits_to_digits(aPrecision,10))
 {
-  iNumber = new ANumber(bits_to_digits(aPrecision,10));
   SetIsInteger(true);
 }
 
-BigNumber::~BigNumber()
-{
-  delete iNumber;
-}
-
 void BigNumber::SetTo(const BigNumber& aOther)
 {
   iPrecision = aOther.GetPrecision();
-  if (!iNumber)
-  {
-    iNumber = new ANumber(*aOther.iNumber);
-  }
-  else
-  {
-    iNumber->CopyFrom(*aOther.iNumber);
-  }
+  iNumber->CopyFrom(*aOther.iNumber);
   SetIsInteger(aOther.IsInt());
 }
 
@@ -301,6 +286,34 @@ double BigNumber::Double() const
     return d;
 }
 
+bool BigNumber::ToLong(long& aValue) const
+{
+    if (!IsInt() || iNumber->iTensExp != 0 || iNumber->iExp < 0)
+        return false;
+
+    const ANumber& a = *iNumber;
+
+    int top = a.size();
+    while (top > a.iExp && a[top - 1] == 0)
+        top--;
+
+    // leave the sign bit alone, so that the value can be negated
+    if ((top - a.iExp) * WordBits >= 8 * sizeof(long) - 1)
+        return false;
+
+    for (int i = 0; i < a.iExp && i < top; ++i)
+        if (a[i])
+            return false;
+
+    unsigned long value = 0;
+    for (int i = top - 1; i >= a.iExp; --i)
+        value = (value << WordBits) | a[i];
+
+    aValue = a.iNegative ? -static_cast<long>(value) : static_cast<long>(value);
+
+    return true;
+}
+
 
 
 
@@ -991,7 +1004,6 @@ void BigNumber::SetTo(const char* aString,int aBasePrecision,int aBase)
     isFloat = 1;
   }
 */
-  if (!iNumber)   iNumber = new ANumber(digits);
   iNumber->SetPrecision(digits);
   iNumber->SetTo(aString,aBase);
 
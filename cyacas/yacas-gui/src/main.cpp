@@ -18,7 +18,7 @@ int main(int argc, char *argv[])
   QApplication app(argc, argv);
     
   try {
-    #ifndef NO_GLOBALS
+    #ifdef YACAS_OBMALLOC
       PlatObSetThreadSafe(true);
     #endif    
 
@@ -39,7 +39,7 @@ YacasEngine::~YacasEngine()
 
 void YacasEngine::cancel()
 {
-    _yacas->getDefEnv().getEnv().stop_evaluation = true;
+    _yacas->getDefEnv().getEnv().Interrupt();
 }
 
 QStringList YacasEngine::symbols() const
@@ -65,7 +65,7 @@ void YacasEngine::on_start_processing()
         if (_requests.shutdown)
             return;
 
-        _yacas->getDefEnv().getEnv().stop_evaluation = false;
+        _yacas->getDefEnv().getEnv().ClearInterrupt();
         
         busy(true);
         
@@ -42,7 +42,7 @@ YacasEngine::YacasEngine(const std::string& scripts_path, const zmqpp::context&
 YacasEngine::~YacasEngine()
 {
     _shutdown = true;
-    _yacas.getDefEnv().getEnv().stop_evaluation = true;
+    _yacas.getDefEnv().getEnv().Interrupt();
     _cv.notify_all();
     _worker_thread->join();
     
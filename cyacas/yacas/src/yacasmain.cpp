@@ -20,6 +20,15 @@
 //            read statement only.
 //      - p : plain mode. No fancy readline functionality.
 //      - c : inhibits printing the prompt to the console
+//      --hash-cons : share identical subexpressions of the loaded
+//            scripts, see LispEnvironment::SetHashConsing()
+//      --max-memory <bytes> : limit the memory used by the session,
+//            including the loaded scripts, see LispArena::SetMemoryLimit()
+//      --no-rule-compilation : interpret all the rules rather than
+//            evaluating their compiled forms, see
+//            LispEnvironment::SetRuleCompilation()
+//      --stack-evaluator : evaluate with StackEvaluator, which keeps
+//            nested calls on the heap rather than on the native stack
 //   4)
 //  -i <command> : execute <command>
 //
@@ -74,6 +83,7 @@
 #include "yacas/arggetter.h"
 
 #include "yacas/errors.h"
+#include "yacas/lispstackeval.h"
 #include "yacas/string_utils.h"
 
 #ifndef YACAS_VERSION
@@ -96,6 +106,10 @@ bool use_texmacs_out = false;
 
 bool patchload = false;
 bool exit_after_files = false;
+bool hash_cons = false;
+std::size_t max_memory = 0;
+bool rule_compilation = true;
+bool stack_evaluator = false;
 
 std::string root_dir;
 std::string doc_dir;
@@ -103,6 +117,10 @@ std::string init_script = "yacasinit.ys";
 
 const char* read_eval_print = "REP()";
 
+// number of objects freed while an evaluation is running, the rest of
+// the garbage is freed after the result has been shown
+const std::size_t reclaim_budget = 4096;
+
 
 static bool readmode = false;
 
@@ -346,6 +364,19 @@ void LoadYacas(std::ostream& os)
 
 #undef CORE_KERNEL_FUNCTION
 
+    if (hash_cons)
+        yacas->getDefEnv().getEnv().SetHashConsing(true);
+
+    yacas->getDefEnv().getArena().SetMemoryLimit(max_memory);
+
+    yacas->getDefEnv().getEnv().SetRuleCompilation(rule_compilation);
+
+    if (stack_evaluator) {
+        LispEnvironment& env = yacas->getDefEnv().getEnv();
+        delete env.iEvaluator;
+        env.iEvaluator = new StackEvaluator;
+    }
+
     {
         /* Split up root_dir in pieces separated by colons, and run
            DefaultDirectory on each of them. */
@@ -429,7 +460,7 @@ void InterruptHandler(void)
 #endif
 {
     std::cout << "^C pressed\n";
-    yacas->getDefEnv().getEnv().stop_evaluation = true;
+    yacas->getDefEnv().getEnv().Interrupt();
 
     if (readmode)
         std::exit(EXIT_SUCCESS);
@@ -464,6 +495,8 @@ void runconsole(const std::string& inprompt, const std::string& outprompt)
                 std::cout << yacas->Error() << "\n";
         }
     } else {
+        LispObject::SetReclaimBudget(reclaim_budget);
+
         while (busy) {
             ReadInputString(inprompt);
 
@@ -489,6 +522,8 @@ void runconsole(const std::string& inprompt, const std::string& outprompt)
                 std::cout << TEXMACS_DATA_END;
 
             std::cout << std::flush;
+
+            LispObject::Reclaim();
         }
     }
 }
@@ -505,6 +540,16 @@ int parse_options(int argc, char** argv)
                 read_eval_print = nullptr;
             } else if (!std::strcmp(argv[fileind],"--patchload")) {
                 patchload = true;
+            } else if (!std::strcmp(argv[fileind],"--hash-cons")) {
+                hash_cons = true;
+            } else if (!std::strcmp(argv[fileind],"--no-rule-compilation")) {
+                rule_compilation = false;
+            } else if (!std::strcmp(argv[fileind],"--stack-evaluator")) {
+                stack_evaluator = true;
+            } else if (!std::strcmp(argv[fileind],"--max-memory")) {
+                fileind++;
+                if (fileind < argc)
+                    max_memory = std::strtoull(argv[fileind], nullptr, 10);
             } else if (!std::strcmp(argv[fileind],"--init")) {
                 fileind++;
                 if (fileind<argc)
@@ -564,7 +609,7 @@ int parse_options(int argc, char** argv)
                     std::exit(EXIT_SUCCESS);
                 }
 
-#ifndef NO_GLOBALS
+#ifdef YACAS_OBMALLOC
                 if (std::strchr(argv[fileind],'m')) {
                     extern void
                         Malloc_SetHooks( void *(*malloc_func)(size_t),
@@ -0,0 +1,220 @@
+// Tests of the C++ engine which are not written as scripts, as they use
+// the CYacas interface itself. The only argument is the directory of
+// the scripts.
+
+#include "yacas/yacas.h"
+#include "yacas/lispstackeval.h"
+#include "yacas/standard.h"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+    int failures = 0;
+
+    void Fail(const std::string& aWhat)
+    {
+        std::cerr << "FAILED: " << aWhat << std::endl;
+        ++failures;
+    }
+
+    // Evaluate aExpression and check that the result is aExpected.
+    void Verify(CYacas& aYacas, const std::string& aExpression, const std::string& aExpected)
+    {
+        aYacas.Evaluate(aExpression);
+
+        if (aYacas.IsError())
+            Fail(aExpression + " gives the error " + aYacas.Error());
+        else if (aYacas.Result() != aExpected)
+            Fail(aExpression + " gives " + aYacas.Result() + " instead of " + aExpected);
+    }
+
+    // Load the standard scripts from aRootDir.
+    void Init(CYacas& aYacas, const std::string& aRootDir)
+    {
+        aYacas.Evaluate("DefaultDirectory(\"" + aRootDir + "/\");");
+        aYacas.Evaluate("Load(\"yacasinit.ys\");");
+
+        if (aYacas.IsError())
+            Fail("loading the scripts: " + aYacas.Error());
+    }
+
+    // Engines attached to a frozen one share its definitions, and
+    // define their own on top of them.
+    void TestAttach(const std::string& aRootDir)
+    {
+        std::ostringstream output;
+
+        CYacas base(output);
+        Init(base, aRootDir);
+        base.Evaluate("attachtest(_x) <-- base;");
+        base.Evaluate("attachvar := {a, b};");
+        base.Evaluate("attachalias := {{a}, {b}};");
+        base.Evaluate("attachnested := {{a}, {b}};");
+        base.Freeze();
+
+        CYacas first(output, base);
+        CYacas second(output, base);
+
+        Verify(first, "attachtest(1)", "base;");
+        Verify(second, "attachtest(1)", "base;");
+        Verify(first, "Expand((x+1)^2)", "x^2+2*x+1;");
+        Verify(second, "Expand((x+1)^2)", "x^2+2*x+1;");
+
+        Verify(first, "[Retract(\"attachtest\", 1); attachtest(_x) <-- first; attachtest(1);]", "first;");
+        Verify(second, "attachtest(1)", "base;");
+
+        Verify(first, "[DestructiveAppend(attachvar, c); attachvar;]", "{a,b,c};");
+        Verify(second, "attachvar", "{a,b};");
+
+        // changes through a local alias or into a nested list show in
+        // the variable, as they do for lists which aren't frozen
+        Verify(first, "[Local(l); l := attachalias; DestructiveAppend(l, c); {l, attachalias};]",
+               "{{{a},{b},c},{{a},{b},c}};");
+        Verify(first, "[Local(l); l := attachnested[1]; DestructiveAppend(l, c); attachnested;]",
+               "{{a,c},{b}};");
+        Verify(second, "{attachalias, attachnested}", "{{{a},{b}},{{a},{b}}};");
+
+        Verify(second, "attachtest2() := second", "True;");
+        Verify(first, "attachtest2()", "attachtest2();");
+
+        // the frozen engine itself is no longer evaluated in
+        base.Evaluate("attachtest(1)");
+        if (!base.IsError())
+            Fail("evaluating in a frozen engine gives " + base.Result());
+    }
+
+    // Parse aExpression, as CYacas::Evaluate() does.
+    LispPtr Parse(LispEnvironment& aEnvironment, const std::string& aExpression)
+    {
+        LispString full(aExpression);
+        full.push_back(';');
+        StringInput input(full, aEnvironment.iInputStatus);
+        InfixParser parser(*aEnvironment.iCurrentTokenizer, input, aEnvironment,
+                           aEnvironment.PreFix(), aEnvironment.InFix(),
+                           aEnvironment.PostFix(), aEnvironment.Bodied());
+        LispPtr expression;
+        parser.Parse(expression);
+        return expression;
+    }
+
+    // The stack evaluator carries out an evaluation in slices, shows
+    // where it is in between, and gives up one.
+    void TestSteps(const std::string& aRootDir)
+    {
+        std::ostringstream output;
+
+        CYacas yacas(output);
+        Init(yacas, aRootDir);
+        yacas.Evaluate("steptest(_n) <-- If(n = 0, 0, 1 + steptest(n - 1));");
+
+        LispEnvironment& env = yacas.getDefEnv().getEnv();
+        StackEvaluator* evaluator = new StackEvaluator;
+        delete env.iEvaluator;
+        env.iEvaluator = evaluator;
+
+        {
+            LispArenaScope arenaScope(yacas.getDefEnv().getArena());
+
+            LispPtr expression = Parse(env, "steptest(50)");
+            LispPtr result;
+            std::size_t slices = 1;
+            bool shown = false;
+
+            evaluator->Start(env, expression);
+            while (!evaluator->Resume(env, result, 100)) {
+                std::ostringstream frames;
+                evaluator->ShowFrames(env, frames, 1000);
+                if (frames.str().find("steptest (Rule # 0 in body)") != std::string::npos)
+                    shown = true;
+                ++slices;
+            }
+
+            if (slices < 2)
+                Fail("steptest(50) takes a single slice");
+            if (!shown)
+                Fail("the frames of steptest(50) are not shown");
+
+            LispString printed;
+            PrintExpression(printed, result, env, 60);
+            if (printed != "50")
+                Fail("steptest(50) gives " + printed + " in slices");
+
+            expression = Parse(env, "steptest(1000)");
+            evaluator->Start(env, expression);
+            if (evaluator->Resume(env, result, 500))
+                Fail("steptest(1000) takes a single slice");
+            evaluator->Abandon(env);
+        }
+
+        // the local variables of the evaluation given up are gone
+        Verify(yacas, "IsBound(n)", "False;");
+        Verify(yacas, "steptest(20)", "20;");
+    }
+
+    // An evaluation which takes too long is stopped, even if it traps
+    // the error, and the engine can be used again.
+    void TestTimeout(const std::string& aRootDir)
+    {
+        std::ostringstream output;
+
+        CYacas yacas(output);
+        Init(yacas, aRootDir);
+
+        const std::chrono::milliseconds timeout(100);
+
+        yacas.EvaluateWithTimeout("While (True) True", timeout);
+        if (yacas.Error().find("Evaluation timed out") == std::string::npos)
+            Fail("an endless loop isn't stopped: " + yacas.Error());
+
+        yacas.EvaluateWithTimeout("While (True) TrapError(While (True) True, False)", timeout);
+        if (yacas.Error().find("Evaluation timed out") == std::string::npos)
+            Fail("an endless loop trapping errors isn't stopped: " + yacas.Error());
+
+        // the deadline, which has passed, is gone
+        Verify(yacas, "[Local(i); i := 0; While (i < 100000) i++; i;]", "100000;");
+
+        yacas.EvaluateWithTimeout("10!", std::chrono::seconds(60));
+        if (yacas.IsError() || yacas.Result() != "3628800;")
+            Fail("10! with a timeout gives " + yacas.Result() + yacas.Error());
+    }
+
+    // The objects waiting to be freed don't count against the memory
+    // limit.
+    void TestMemoryLimit(const std::string& aRootDir)
+    {
+        std::ostringstream output;
+
+        CYacas yacas(output);
+        Init(yacas, aRootDir);
+
+        yacas.getDefEnv().getArena().SetMemoryLimit(yacas.getDefEnv().getArena().Stats().live_bytes + 20000000);
+        LispObject::SetReclaimBudget(1);
+
+        // each list takes about 8.5 MB
+        Verify(yacas, "[Local(l, i); For(i := 0, i < 3, i++) [ l := {1}; While(Length(l) < 131072) l := Concat(l, l); l := {}; ]; i;]", "3;");
+
+        LispObject::SetReclaimBudget(0);
+        LispObject::Reclaim();
+        yacas.getDefEnv().getArena().SetMemoryLimit(0);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " <scripts directory>" << std::endl;
+        return 2;
+    }
+
+    const std::string rootDir = argv[1];
+
+    TestAttach(rootDir);
+    TestSteps(rootDir);
+    TestTimeout(rootDir);
+    TestMemoryLimit(rootDir);
+
+    return failures == 0 ? 0 : 1;
+}